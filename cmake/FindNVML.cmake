@@ -9,12 +9,12 @@
 # The module defines:                                                         #
 #   - NVML_FOUND        - If NVML was found                                   #
 #   - NVML_INCLUDE_DIRS - the NVML include directories                        #
-#   - NVML_LIBRARIES    - the NVML library directories                        #
+#   - NVML_LIBRARIES    - the NVML library, if found (optional)               #
 #   - NVML_API_VERSION  - the NVML api version                                #
 #                                                                             #
 #/////////////////////////////////////////////////////////////////////////////#
 
-if (NVML_INCLUDE_DIRS AND NVML_LIBRARIES)
+if (NVML_INCLUDE_DIRS)
     set(NVML_FIND_QUIETLY TRUE)
 endif()
 
@@ -23,7 +23,7 @@ file(GLOB nvml_header_path_hint /usr/include/nvidia*/include /usr/local/cuda*/in
 find_path(NVML_INCLUDE_DIRS NAMES nvml.h
         PATHS ${nvml_header_path_hint} ${PROJECT_BINARY_DIR}/include)
 
-# library
+# library, optional: it is only needed at runtime, where the plugins load it themselves
 if("${CMAKE_SIZEOF_VOID_P}" EQUAL "8") # 64bit
     file(GLOB nvml_lib_path_hint /usr/lib64/nvidia*/ /usr/lib/nvidia*/ /usr/local/cuda*/targets/*/lib/stubs/)
 else() # assume 32bit
@@ -51,7 +51,7 @@ endif(EXISTS ${filename})
 include(FindPackageHandleStandardArgs)
 FIND_PACKAGE_HANDLE_STANDARD_ARGS(NVML
         FOUND_VAR NVML_FOUND
-        REQUIRED_VARS NVML_INCLUDE_DIRS NVML_LIBRARIES
+        REQUIRED_VARS NVML_INCLUDE_DIRS
         VERSION_VAR NVML_API_VERSION)
 
 mark_as_advanced(NVML_INCLUDE_DIRS NVML_LIBRARIES NVML_API_VERSION)
\ No newline at end of file
@@ -0,0 +1,63 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_COUNTER_HPP
+#define SCOREP_PLUGIN_NVML_NVML_COUNTER_HPP
+
+#include <chrono>
+#include <cstdint>
+
+/** Turns readings of a monotonically increasing counter (e.g. NVLink bytes or error counts)
+ *  into either a rate per second (rate == true) or the total since the first reading.
+ *  The counter may wrap around at 2^bits. A delta of more than half the range is taken as
+ *  a reset of the counter (e.g. by the driver) and the new raw value is used as delta.
+ *  Deltas are multiplied with scale, e.g. 1024 for counters in KiB.
+ */
+class counter_state {
+public:
+    // false if no value can be derived yet, i.e. for the first reading of a rate
+    bool update(std::uint64_t raw,
+                std::chrono::system_clock::time_point time,
+                unsigned int bits,
+                std::uint64_t scale,
+                bool rate,
+                std::uint64_t& value)
+    {
+        if (!valid) {
+            valid = true;
+            last_raw = raw;
+            last_time = time;
+            value = 0;
+            return !rate;
+        }
+
+        std::uint64_t mask = bits >= 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << bits) - 1;
+        std::uint64_t delta = (raw - last_raw) & mask;
+        if (delta > mask / 2) {
+            delta = raw & mask;
+        }
+
+        if (!rate) {
+            total += delta * scale;
+            value = total;
+            last_raw = raw;
+            last_time = time;
+            return true;
+        }
+
+        double seconds = std::chrono::duration<double>(time - last_time).count();
+        if (seconds <= 0) {
+            // same timestamp (e.g. timestamp mode sweep), wait for the next reading
+            return false;
+        }
+        value = static_cast<std::uint64_t>(double(delta) * scale / seconds + 0.5);
+        last_raw = raw;
+        last_time = time;
+        return true;
+    }
+
+private:
+    bool valid = false;
+    std::uint64_t last_raw = 0;
+    std::chrono::system_clock::time_point last_time;
+    std::uint64_t total = 0;
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_COUNTER_HPP
@@ -0,0 +1,475 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_DERIVED_HPP
+#define SCOREP_PLUGIN_NVML_NVML_DERIVED_HPP
+
+#include "nvml_counter.hpp"
+#include "nvml_runtime.hpp"
+#include "nvml_wrapper.hpp"
+
+#include <nvml.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// metric names only consist of [a-z0-9_], everything else is an expression
+inline bool is_derived_metric_name(const std::string& metric_name)
+{
+    return metric_name.find_first_of("()@+-*/") != std::string::npos;
+}
+
+/** A metric computed from other polled metrics when it is read, e.g.
+ *    sum(power_usage@*)            node power, one value for all devices
+ *    avg(utilization_gpu@*)        also min and max
+ *    power_usage/utilization_gpu   per device
+ *    power_usage@0-power_usage@1   explicit devices by NVML index
+ *  with + - * /, parentheses and numbers. Expressions without a plain metric name are
+ *  evaluated once per node, all others per device. The inputs are read by the derived metric
+ *  itself, so they do not need to be requested. Each input metric is read once per device and
+ *  sweep, i.e. until a device is evaluated again, however often the expression uses it. Inputs
+ *  that are requested as well are fed from their reads by the measurement instead (see
+ *  feed_input), so they are not read twice and the derived value matches the recorded one.
+ *  Values are doubles, NaN if a division by zero occurs or a counter input has no rate yet.
+ */
+class Derived_Metric : public Nvml_Metric {
+public:
+    // creates the metric of an input from its name, replaceable for tests
+    using input_factory = Nvml_Metric* (*)(std::string);
+
+    Derived_Metric(const std::string& expression,
+                   const std::vector<nvml_device_info>& devices_,
+                   input_factory create_input_ = metric_name_2_nvml_function)
+        : create_input(create_input_), text(expression)
+    {
+        for (auto& info : devices_) {
+            devices.push_back(info.device);
+            indices.push_back(info.index);
+        }
+        evaluated.resize(devices.size(), false);
+
+        root = parse_sum();
+        skip_space();
+        if (pos != text.size()) {
+            error("unexpected '" + text.substr(pos, 1) + "'");
+        }
+
+        name = expression;
+        desc = "Derived metric " + expression;
+        unit = root->unit;
+        type = metric_measure_type::ABS;
+        datatype = metric_datatype::DOUBLE;
+        api = "derived metric";
+    }
+
+    // value is the bit pattern of the double result
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value) override
+    {
+        // devices may be polled by different threads
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t device_idx = position(device);
+        if (device_idx == devices.size()) {
+            return NVML_ERROR_INVALID_ARGUMENT;
+        }
+        // a device evaluated before starts the next sweep
+        if (evaluated[device_idx]) {
+            start_sweep();
+        }
+        evaluated[device_idx] = true;
+
+        double result = 0;
+        nvmlReturn_t ret = evaluate(*root, device_idx, result);
+        value = double_to_bits(result);
+
+        return ret;
+    }
+
+    bool is_per_device() const override
+    {
+        return per_device;
+    }
+
+    /** From now on the input metric_name on device is only taken from feed, it is no longer read
+     *  by the derived metric. Returns the input to feed, -1 if the expression does not use
+     *  metric_name.
+     */
+    int feed_input(const std::string& metric_name, nvmlDevice_t device)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (std::size_t input_idx = 0; input_idx < inputs.size(); ++input_idx) {
+            input& in = inputs[input_idx];
+            if (in.metric->get_name() != metric_name) {
+                continue;
+            }
+            std::size_t device_idx = position(device);
+            if (device_idx < devices.size() && !in.fed[device_idx]) {
+                // nothing fed yet, like a counter without a rate
+                in.fed[device_idx] = true;
+                in.results[device_idx] = NVML_SUCCESS;
+                in.values[device_idx] = NAN;
+            }
+            return input_idx;
+        }
+        return -1;
+    }
+
+    // a read of the input metric on device at timestamp, the latest one is used until the next
+    void feed(int input_idx, nvmlDevice_t device, nvmlReturn_t ret, std::uint64_t value,
+              std::chrono::system_clock::time_point timestamp)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t device_idx = position(device);
+        if (device_idx < devices.size()) {
+            store(inputs[input_idx], device_idx, ret, value, timestamp);
+        }
+    }
+
+private:
+    // a metric used in the expression, with its readings of the current sweep per device
+    struct input {
+        std::unique_ptr<Nvml_Metric> metric;
+        // previous raw values of counters
+        std::vector<counter_state> counters;
+        std::vector<bool> read;
+        // fed by the measurement instead of read
+        std::vector<bool> fed;
+        std::vector<nvmlReturn_t> results;
+        std::vector<double> values;
+    };
+
+    struct node {
+        enum { constant, input, reduction, binary } kind;
+        double number = 0;
+
+        // input and reduction: index in inputs
+        std::size_t input_idx = 0;
+        // index in devices, -1 for the device the expression is evaluated on
+        int device = -1;
+        // sum, avg, min or max
+        std::string function;
+
+        // binary
+        char op = 0;
+        std::unique_ptr<node> left;
+        std::unique_ptr<node> right;
+
+        std::string unit;
+    };
+
+    [[noreturn]] void error(const std::string& message) const
+    {
+        throw std::runtime_error("Invalid derived metric " + text + ": " + message);
+    }
+
+    void skip_space()
+    {
+        while (pos < text.size() && text[pos] == ' ') {
+            ++pos;
+        }
+    }
+
+    bool accept(char c)
+    {
+        skip_space();
+        if (pos < text.size() && text[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c)
+    {
+        if (!accept(c)) {
+            error(std::string("expected '") + c + "'");
+        }
+    }
+
+    std::string parse_identifier()
+    {
+        skip_space();
+        std::size_t begin = pos;
+        while (pos < text.size() &&
+               (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_')) {
+            ++pos;
+        }
+        if (begin == pos) {
+            error("expected a metric name at position " + std::to_string(begin));
+        }
+        return text.substr(begin, pos - begin);
+    }
+
+    // metrics used several times share one input
+    std::unique_ptr<node> make_input(const std::string& metric_name)
+    {
+        std::unique_ptr<node> n(new node);
+        n->kind = node::input;
+        for (n->input_idx = 0; n->input_idx < inputs.size(); ++n->input_idx) {
+            if (inputs[n->input_idx].metric->get_name() == metric_name) {
+                break;
+            }
+        }
+        if (n->input_idx == inputs.size()) {
+            input in;
+            in.metric.reset(create_input(metric_name));
+            for (std::size_t i = 0; i < devices.size(); ++i) {
+                in.metric->bind_device(devices[i], indices[i]);
+            }
+            in.counters.resize(devices.size());
+            in.read.resize(devices.size(), false);
+            in.fed.resize(devices.size(), false);
+            in.results.resize(devices.size(), NVML_SUCCESS);
+            in.values.resize(devices.size(), 0);
+            blocking = blocking || in.metric->is_blocking();
+            inputs.push_back(std::move(in));
+        }
+        n->unit = inputs[n->input_idx].metric->get_unit();
+        return n;
+    }
+
+    std::unique_ptr<node> make_binary(char op, std::unique_ptr<node> left, std::unique_ptr<node> right)
+    {
+        std::unique_ptr<node> n(new node);
+        n->kind = node::binary;
+        n->op = op;
+        if (right->unit.empty()) {
+            n->unit = left->unit;
+        }
+        else if (op == '+' || op == '-' || (op == '*' && left->unit.empty())) {
+            n->unit = left->unit.empty() ? right->unit : left->unit;
+        }
+        else {
+            n->unit = (left->unit.empty() ? "1" : left->unit) + op + right->unit;
+        }
+        n->left = std::move(left);
+        n->right = std::move(right);
+        return n;
+    }
+
+    std::unique_ptr<node> parse_sum()
+    {
+        std::unique_ptr<node> left = parse_product();
+        while (true) {
+            if (accept('+')) {
+                left = make_binary('+', std::move(left), parse_product());
+            }
+            else if (accept('-')) {
+                left = make_binary('-', std::move(left), parse_product());
+            }
+            else {
+                return left;
+            }
+        }
+    }
+
+    std::unique_ptr<node> parse_product()
+    {
+        std::unique_ptr<node> left = parse_factor();
+        while (true) {
+            if (accept('*')) {
+                left = make_binary('*', std::move(left), parse_factor());
+            }
+            else if (accept('/')) {
+                left = make_binary('/', std::move(left), parse_factor());
+            }
+            else {
+                return left;
+            }
+        }
+    }
+
+    std::unique_ptr<node> parse_factor()
+    {
+        if (accept('(')) {
+            std::unique_ptr<node> n = parse_sum();
+            expect(')');
+            return n;
+        }
+
+        skip_space();
+        if (pos < text.size() && (std::isdigit(static_cast<unsigned char>(text[pos])) || text[pos] == '.')) {
+            char* end;
+            std::unique_ptr<node> n(new node);
+            n->kind = node::constant;
+            n->number = std::strtod(text.c_str() + pos, &end);
+            pos = end - text.c_str();
+            return n;
+        }
+
+        std::string identifier = parse_identifier();
+        if (identifier == "sum" || identifier == "avg" || identifier == "min" || identifier == "max") {
+            expect('(');
+            std::unique_ptr<node> n = make_input(parse_identifier());
+            n->kind = node::reduction;
+            n->function = identifier;
+            expect('@');
+            expect('*');
+            expect(')');
+            return n;
+        }
+
+        std::unique_ptr<node> n = make_input(identifier);
+        if (!accept('@')) {
+            per_device = true;
+            return n;
+        }
+        skip_space();
+        std::size_t begin = pos;
+        while (pos < text.size() && std::isdigit(static_cast<unsigned char>(text[pos]))) {
+            ++pos;
+        }
+        if (begin == pos) {
+            error("expected a device index after " + identifier + "@, use sum(" + identifier +
+                  "@*) etc. for all devices");
+        }
+        // the NVML index as in the names of the metrics ("on CUDA: 1"), not the position in
+        // devices, which differ if devices before lack permission
+        unsigned int index = std::stoul(text.substr(begin, pos - begin));
+        auto it = std::find(indices.begin(), indices.end(), index);
+        if (it == indices.end()) {
+            error("there is no CUDA device " + std::to_string(index));
+        }
+        n->device = it - indices.begin();
+        return n;
+    }
+
+    std::size_t position(nvmlDevice_t device) const
+    {
+        return std::find(devices.begin(), devices.end(), device) - devices.begin();
+    }
+
+    void start_sweep()
+    {
+        std::fill(evaluated.begin(), evaluated.end(), false);
+        for (auto& in : inputs) {
+            std::fill(in.read.begin(), in.read.end(), false);
+        }
+    }
+
+    // a raw value of the input on devices[device_idx], counters are converted like in the
+    // measurement
+    void store(input& in, std::size_t device_idx, nvmlReturn_t ret, std::uint64_t value,
+               std::chrono::system_clock::time_point timestamp)
+    {
+        in.results[device_idx] = ret;
+        unsigned int bits = in.metric->get_counter_bits();
+        if (NVML_SUCCESS != ret) {
+            in.values[device_idx] = NAN;
+        }
+        else if (bits != 0 &&
+                 !in.counters[device_idx].update(value, timestamp, bits, in.metric->get_counter_scale(),
+                                                 in.metric->get_measure_type() == ABS, value)) {
+            in.values[device_idx] = NAN;
+        }
+        else {
+            in.values[device_idx] = value;
+        }
+    }
+
+    // the input on devices[device_idx], read once per sweep unless it is fed
+    nvmlReturn_t read_input(std::size_t input_idx, std::size_t device_idx, double& result)
+    {
+        input& in = inputs[input_idx];
+        if (!in.read[device_idx] && !in.fed[device_idx]) {
+            in.read[device_idx] = true;
+            std::uint64_t value;
+            nvmlReturn_t ret = in.metric->read(devices[device_idx], value);
+            store(in, device_idx, ret, value, std::chrono::system_clock::now());
+        }
+        result = in.values[device_idx];
+        return in.results[device_idx];
+    }
+
+    // device_idx is the device the expression is evaluated on
+    nvmlReturn_t evaluate(node& n, std::size_t device_idx, double& result)
+    {
+        switch (n.kind) {
+        case node::constant:
+            result = n.number;
+            return NVML_SUCCESS;
+
+        case node::input:
+            return read_input(n.input_idx, n.device < 0 ? device_idx : n.device, result);
+
+        case node::reduction: {
+            // devices that fail are left out, it only fails if all do
+            nvmlReturn_t ret = NVML_ERROR_NOT_FOUND;
+            unsigned int count = 0;
+            double sum = 0;
+            for (std::size_t i = 0; i < devices.size(); ++i) {
+                double value;
+                nvmlReturn_t device_ret = read_input(n.input_idx, i, value);
+                if (NVML_SUCCESS != device_ret) {
+                    ret = device_ret;
+                    continue;
+                }
+                if (count == 0 || n.function == "sum" || n.function == "avg") {
+                    sum = count == 0 ? value : sum + value;
+                }
+                else if (n.function == "min") {
+                    sum = std::min(sum, value);
+                }
+                else {
+                    sum = std::max(sum, value);
+                }
+                ++count;
+            }
+            if (count == 0) {
+                return ret;
+            }
+            result = n.function == "avg" ? sum / count : sum;
+            return NVML_SUCCESS;
+        }
+
+        case node::binary: {
+            double left, right;
+            nvmlReturn_t ret = evaluate(*n.left, device_idx, left);
+            if (NVML_SUCCESS != ret) {
+                return ret;
+            }
+            ret = evaluate(*n.right, device_idx, right);
+            if (NVML_SUCCESS != ret) {
+                return ret;
+            }
+            switch (n.op) {
+            case '+':
+                result = left + right;
+                break;
+            case '-':
+                result = left - right;
+                break;
+            case '*':
+                result = left * right;
+                break;
+            default:
+                result = right == 0 ? NAN : left / right;
+            }
+            return NVML_SUCCESS;
+        }
+        }
+        return NVML_ERROR_UNKNOWN;
+    }
+
+    input_factory create_input;
+    std::vector<nvmlDevice_t> devices;
+    // NVML index of each device
+    std::vector<unsigned int> indices;
+    std::vector<input> inputs;
+    std::unique_ptr<node> root;
+    bool per_device = false;
+
+    std::mutex mutex;
+    // devices the expression has been evaluated on in this sweep
+    std::vector<bool> evaluated;
+
+    // parser state
+    std::string text;
+    std::size_t pos = 0;
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_DERIVED_HPP
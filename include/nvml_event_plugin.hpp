@@ -0,0 +1,9 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_EVENT_PLUGIN_HPP
+#define SCOREP_PLUGIN_NVML_NVML_EVENT_PLUGIN_HPP
+
+#include "nvml_plugin_core.hpp"
+
+class nvml_event_plugin : public nvml_plugin_core<nvml_event_plugin, event_reader, async_post_mortem_delivery> {
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_EVENT_PLUGIN_HPP
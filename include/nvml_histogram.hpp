@@ -0,0 +1,91 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_HISTOGRAM_HPP
+#define SCOREP_PLUGIN_NVML_NVML_HISTOGRAM_HPP
+
+#include <array>
+#include <cstdint>
+
+/** Log-linear (HDR style) histogram of durations in nanoseconds. Each power of two is split
+ *  into 8 sub-buckets, so values are kept with at most 12.5% relative error in constant memory.
+ */
+class latency_histogram {
+public:
+    void record(std::uint64_t ns)
+    {
+        ++buckets[index(ns)];
+        ++n;
+        total += ns;
+        if (ns < minimum) {
+            minimum = ns;
+        }
+        if (ns > maximum) {
+            maximum = ns;
+        }
+    }
+
+    std::uint64_t count() const
+    {
+        return n;
+    }
+
+    std::uint64_t sum() const
+    {
+        return total;
+    }
+
+    std::uint64_t min() const
+    {
+        return n == 0 ? 0 : minimum;
+    }
+
+    std::uint64_t max() const
+    {
+        return maximum;
+    }
+
+    // upper bound of the bucket containing the p-th percentile, p in [0, 100]
+    std::uint64_t percentile(double p) const
+    {
+        std::uint64_t rank = static_cast<std::uint64_t>(p / 100.0 * n + 0.5);
+        if (rank == 0) {
+            rank = 1;
+        }
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < buckets.size(); ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                std::uint64_t upper = upper_bound(i);
+                return upper < maximum ? upper : maximum;
+            }
+        }
+        return maximum;
+    }
+
+private:
+    static std::size_t index(std::uint64_t value)
+    {
+        if (value < 8) {
+            return value;
+        }
+        unsigned int msb = 63 - __builtin_clzll(value);
+        unsigned int shift = msb - 3;
+        return ((shift + 1) << 3) + ((value >> shift) & 7);
+    }
+
+    static std::uint64_t upper_bound(std::size_t index)
+    {
+        if (index < 8) {
+            return index;
+        }
+        unsigned int shift = (index >> 3) - 1;
+        std::uint64_t lower = (8 + (index & 7)) << shift;
+        return lower + (std::uint64_t(1) << shift) - 1;
+    }
+
+    std::array<std::uint64_t, 62 * 8> buckets{};
+    std::uint64_t n = 0;
+    std::uint64_t total = 0;
+    std::uint64_t minimum = UINT64_MAX;
+    std::uint64_t maximum = 0;
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_HISTOGRAM_HPP
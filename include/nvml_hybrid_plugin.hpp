@@ -0,0 +1,9 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_HYBRID_PLUGIN_HPP
+#define SCOREP_PLUGIN_NVML_NVML_HYBRID_PLUGIN_HPP
+
+#include "nvml_plugin_core.hpp"
+
+class nvml_hybrid_plugin : public nvml_plugin_core<nvml_hybrid_plugin, hybrid_reader, async_post_mortem_delivery> {
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_HYBRID_PLUGIN_HPP
@@ -0,0 +1,63 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_LIVE_VALUE_HPP
+#define SCOREP_PLUGIN_NVML_NVML_LIVE_VALUE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/** Latest value of one handle, written by the measurement thread and read by the metrics
+ *  endpoint. It is a sequence lock: the writer never waits, a reader retries if it overlapped
+ *  with a write.
+ */
+class live_value {
+public:
+    // family is an OpenMetrics metric name, labels is e.g. device="0" or empty
+    live_value(const std::string& family_,
+               const std::string& help_,
+               const std::string& labels_,
+               bool is_double_)
+        : family(family_), help(help_), labels(labels_), is_double(is_double_)
+    {
+    }
+
+    void publish(std::uint64_t value, std::int64_t time_us)
+    {
+        unsigned int s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        latest.store(value, std::memory_order_relaxed);
+        latest_time_us.store(time_us, std::memory_order_relaxed);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    // false if nothing was published yet or the writer kept interfering
+    bool read(std::uint64_t& value, std::int64_t& time_us) const
+    {
+        for (int attempt = 0; attempt < 1000; ++attempt) {
+            unsigned int before = seq.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            value = latest.load(std::memory_order_relaxed);
+            time_us = latest_time_us.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == before) {
+                return before != 0;
+            }
+        }
+        return false;
+    }
+
+    const std::string family;
+    const std::string help;
+    const std::string labels;
+    // value is the bit pattern of a double
+    const bool is_double;
+
+private:
+    std::atomic<unsigned int> seq{ 0 };
+    std::atomic<std::uint64_t> latest{ 0 };
+    std::atomic<std::int64_t> latest_time_us{ 0 };
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_LIVE_VALUE_HPP
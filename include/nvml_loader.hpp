@@ -0,0 +1,220 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_LOADER_HPP
+#define SCOREP_PLUGIN_NVML_NVML_LOADER_HPP
+
+#include <nvml.h>
+
+#include <dlfcn.h>
+
+#include <cstdlib>
+#include <string>
+
+/** All NVML functions used by the plugins. Names are the ones from nvml.h, macros like
+ *  nvmlInit -> nvmlInit_v2 apply, so the newest version known to the header is requested.
+ */
+#define SCOREP_NVML_FUNCTIONS(F)                                                                   \
+    F(nvmlInit)                                                                                    \
+    F(nvmlShutdown)                                                                                \
+    F(nvmlErrorString)                                                                             \
+    F(nvmlDeviceGetCount)                                                                          \
+    F(nvmlDeviceGetHandleByIndex)                                                                  \
+    F(nvmlDeviceGetIndex)                                                                          \
+    F(nvmlDeviceGetName)                                                                           \
+    F(nvmlDeviceGetUUID)                                                                           \
+    F(nvmlDeviceGetPciInfo)                                                                        \
+    F(nvmlDeviceGetCpuAffinity)                                                                    \
+    F(nvmlDeviceGetMemoryAffinity)                                                                 \
+    F(nvmlDeviceGetPowerUsage)                                                                     \
+    F(nvmlDeviceGetTemperature)                                                                    \
+    F(nvmlDeviceGetClockInfo)                                                                      \
+    F(nvmlDeviceGetApplicationsClock)                                                              \
+    F(nvmlDeviceGetFanSpeed)                                                                       \
+    F(nvmlDeviceGetMemoryInfo)                                                                     \
+    F(nvmlDeviceGetPcieThroughput)                                                                 \
+    F(nvmlDeviceGetUtilizationRates)                                                               \
+    F(nvmlDeviceGetTotalEnergyConsumption)                                                         \
+    F(nvmlDeviceGetSamples)                                                                        \
+    F(nvmlDeviceGetFieldValues)                                                                    \
+    F(nvmlDeviceGetNvLinkErrorCounter)                                                             \
+    F(nvmlDeviceGetPerformanceState)                                                               \
+    F(nvmlDeviceGetCurrentClocksThrottleReasons)                                                   \
+    F(nvmlDeviceGetViolationStatus)                                                                \
+    F(nvmlDeviceGetSupportedEventTypes)                                                            \
+    F(nvmlDeviceRegisterEvents)                                                                    \
+    F(nvmlEventSetCreate)                                                                          \
+    F(nvmlEventSetWait)                                                                            \
+    F(nvmlEventSetFree)                                                                            \
+    SCOREP_NVML_GPM_FUNCTIONS(F)
+
+// GPU Performance Monitoring, only declared by nvml.h of CUDA 12 or newer
+#ifdef NVML_GPM_METRICS_GET_VERSION
+#define SCOREP_NVML_GPM_FUNCTIONS(F)                                                               \
+    F(nvmlGpmQueryDeviceSupport)                                                                   \
+    F(nvmlGpmSampleAlloc)                                                                          \
+    F(nvmlGpmSampleFree)                                                                           \
+    F(nvmlGpmSampleGet)                                                                            \
+    F(nvmlGpmMetricsGet)
+#else
+#define SCOREP_NVML_GPM_FUNCTIONS(F)
+#endif
+
+#define SCOREP_NVML_STRINGIFY_(name) #name
+#define SCOREP_NVML_STRINGIFY(name) SCOREP_NVML_STRINGIFY_(name)
+
+namespace detail {
+// used for every function missing in the loaded library, so calls never go to a null pointer
+template <typename F>
+struct nvml_missing_function;
+
+template <typename... Args>
+struct nvml_missing_function<nvmlReturn_t (*)(Args...)> {
+    static nvmlReturn_t call(Args...)
+    {
+        return NVML_ERROR_FUNCTION_NOT_FOUND;
+    }
+};
+
+template <>
+struct nvml_missing_function<const char* (*)(nvmlReturn_t)> {
+    static const char* call(nvmlReturn_t ret)
+    {
+        return "NVML library not available";
+    }
+};
+} // namespace detail
+
+/** Functions whose older versions have the same signature, so one may stand in for a newer
+ *  version missing in an old driver. Other versions changed a struct (e.g.
+ *  nvmlDeviceGetPciInfo_v3 and nvmlPciInfo_t) and must not be mixed up.
+ */
+inline bool nvml_versions_compatible(const std::string& base_name)
+{
+    return base_name == "nvmlInit" || base_name == "nvmlDeviceGetCount" ||
+           base_name == "nvmlDeviceGetHandleByIndex";
+}
+
+/** NVML resolved at runtime with dlopen/dlsym, so the plugins load on nodes without driver.
+ *  The library is taken from SCOREP_METRIC_NVML_LIBRARY if set (e.g. a stand-in for testing),
+ *  libnvidia-ml.so.1 otherwise. If a symbol like nvmlDeviceGetCount_v2 is missing, older
+ *  versions (nvmlDeviceGetCount) are tried, see nvml_versions_compatible.
+ */
+class nvml_function_table {
+public:
+#define SCOREP_NVML_MEMBER(name) decltype(&::name) name;
+    SCOREP_NVML_FUNCTIONS(SCOREP_NVML_MEMBER)
+#undef SCOREP_NVML_MEMBER
+
+    nvml_function_table()
+    {
+        const char* library = std::getenv("SCOREP_METRIC_NVML_LIBRARY");
+        if (library != nullptr && *library != '\0') {
+            handle = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+        }
+        else {
+            handle = dlopen("libnvidia-ml.so.1", RTLD_NOW | RTLD_LOCAL);
+            if (handle == nullptr) {
+                handle = dlopen("libnvidia-ml.so", RTLD_NOW | RTLD_LOCAL);
+            }
+        }
+        if (handle == nullptr) {
+            error = dlerror();
+        }
+
+#define SCOREP_NVML_RESOLVE(name)                                                                  \
+    name = resolve<decltype(&::name)>(SCOREP_NVML_STRINGIFY(name));
+        SCOREP_NVML_FUNCTIONS(SCOREP_NVML_RESOLVE)
+#undef SCOREP_NVML_RESOLVE
+
+        // without these nothing can be measured
+        if (handle != nullptr && !(found_init && found_shutdown && found_count && found_handle)) {
+            error = "NVML library lacks basic functions";
+            dlclose(handle);
+            handle = nullptr;
+#define SCOREP_NVML_RESET(name)                                                                    \
+    name = &detail::nvml_missing_function<decltype(&::name)>::call;
+            SCOREP_NVML_FUNCTIONS(SCOREP_NVML_RESET)
+#undef SCOREP_NVML_RESET
+        }
+    }
+
+    ~nvml_function_table()
+    {
+        if (handle != nullptr) {
+            dlclose(handle);
+        }
+    }
+
+    nvml_function_table(const nvml_function_table&) = delete;
+    nvml_function_table& operator=(const nvml_function_table&) = delete;
+
+    bool available() const
+    {
+        return handle != nullptr;
+    }
+
+    // reason the library could not be loaded
+    const std::string& get_error() const
+    {
+        return error;
+    }
+
+private:
+    // tries name, then, if compatible, the older versions name_v<N-1> ... down to the
+    // unversioned name
+    template <typename F>
+    F resolve(std::string name)
+    {
+        void* symbol = nullptr;
+        if (handle != nullptr) {
+            while (true) {
+                symbol = dlsym(handle, name.c_str());
+                std::size_t v = name.rfind("_v");
+                if (symbol != nullptr || v == std::string::npos ||
+                    name.find_first_not_of("0123456789", v + 2) != std::string::npos ||
+                    !nvml_versions_compatible(name.substr(0, v))) {
+                    break;
+                }
+                int version = std::atoi(name.c_str() + v + 2);
+                name = name.substr(0, v);
+                if (version > 2) {
+                    name += "_v" + std::to_string(version - 1);
+                }
+            }
+        }
+
+        if (name.compare(0, 8, "nvmlInit") == 0) {
+            found_init = symbol != nullptr;
+        }
+        else if (name == "nvmlShutdown") {
+            found_shutdown = symbol != nullptr;
+        }
+        else if (name.compare(0, 18, "nvmlDeviceGetCount") == 0) {
+            found_count = symbol != nullptr;
+        }
+        else if (name.compare(0, 26, "nvmlDeviceGetHandleByIndex") == 0) {
+            found_handle = symbol != nullptr;
+        }
+
+        if (symbol == nullptr) {
+            return &detail::nvml_missing_function<F>::call;
+        }
+        return reinterpret_cast<F>(symbol);
+    }
+
+    void* handle = nullptr;
+    std::string error;
+
+    bool found_init = false;
+    bool found_shutdown = false;
+    bool found_count = false;
+    bool found_handle = false;
+};
+
+/** The process wide function table, the library is loaded on first use
+ */
+inline nvml_function_table& nvml_lib()
+{
+    static nvml_function_table table;
+    return table;
+}
+
+#endif // SCOREP_PLUGIN_NVML_NVML_LOADER_HPP
@@ -1,18 +1,136 @@
 #ifndef SCOREP_PLUGIN_NVML_NVML_MEASUREMENT_THREAD_HPP
 #define SCOREP_PLUGIN_NVML_NVML_MEASUREMENT_THREAD_HPP
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include <nvml.h>
 
+#include <pthread.h>
+
 #include <scorep/plugin/plugin.hpp>
 
+#include "nvml_counter.hpp"
+#include "nvml_derived.hpp"
+#include "nvml_live_value.hpp"
+#include "nvml_overhead.hpp"
+#include "nvml_summary.hpp"
+#include "nvml_thread_placement.hpp"
+#include "nvml_trigger.hpp"
 #include "nvml_types.hpp"
 #include "nvml_wrapper.hpp"
 
+/** How points of one sweep over all handles are timestamped:
+ *  metric   - system clock is read after each single metric
+ *  sweep    - one timestamp taken before the sweep is used for all metrics
+ *  midpoint - the middle between the timestamps before and after the sweep
+ */
+enum class timestamp_mode { metric, sweep, midpoint };
+
+inline timestamp_mode timestamp_mode_from_string(const std::string& mode)
+{
+    if (mode == "metric") {
+        return timestamp_mode::metric;
+    }
+    if (mode == "sweep") {
+        return timestamp_mode::sweep;
+    }
+    if (mode == "midpoint") {
+        return timestamp_mode::midpoint;
+    }
+    throw std::runtime_error("Unknown timestamp mode: " + mode);
+}
+
+/** Health of one device, shared by all its handles. A device that reports it is lost is
+ *  quarantined: none of its metrics is read until retry_at, then the next due read probes it,
+ *  with pauses growing exponentially while it stays lost. The other devices are not affected.
+ */
+struct device_state {
+    unsigned int index = 0;
+    // written with m_mutex held, read by the slow lane without it
+    std::atomic<bool> lost{ false };
+    std::atomic<steady_clock_t::rep> retry_at{ 0 };
+    unsigned int probes = 0;
+
+    // see nvml_device_info
+    int numa_node = -1;
+    std::vector<int> cpus;
+};
+
+// a polling thread of measurement() and where it runs
+struct poll_worker {
+    int numa_node = -1;
+    std::vector<int> cpus;
+};
+
+/** Readings of one handle and the state of failed reads.
+ *  After a failed read the handle is skipped for an exponentially growing number of sweeps.
+ */
+struct handle_readings {
+    std::vector<pair_chrono_value_t> values;
+
+    unsigned int failures = 0;
+    unsigned int skip = 0;
+
+    // previous raw value of counter metrics
+    counter_state counter;
+
+    // schedule of polled metrics
+    std::chrono::milliseconds interval{ 0 };
+    steady_clock_t::time_point next_due;
+    bool slow_lane = false;
+    unsigned int worker = 0;
+
+    // hybrid measurement: whether the sample buffer is read and the newest sample seen (in us)
+    bool sampled = false;
+    unsigned long long last_seen = 0;
+
+    // latest value for the metrics endpoint, nullptr if it is disabled
+    live_value* live = nullptr;
+    // statistics of all values, nullptr if summaries are disabled
+    value_summary* summary = nullptr;
+
+    // triggered capture: latest points, conditions on this handle and next coarse point
+    capture_ring ring;
+    std::vector<trigger_condition> triggers;
+    system_time_point_t next_coarse;
+
+    device_state* device = nullptr;
+
+    // inputs of derived metrics that are fed from the reads of this handle
+    std::vector<std::pair<Derived_Metric*, int>> feeds;
+    // read only to feed derived metrics, not recorded
+    bool suppressed = false;
+};
+
+// whether handles of a metric are bound to a device, see Nvml_Metric::is_per_device
+inline bool metric_is_per_device(Nvml_Metric* metric)
+{
+    return metric->is_per_device();
+}
+
+inline bool metric_is_per_device(Hybrid_Metric* metric)
+{
+    return metric->get_polled()->is_per_device();
+}
+
+template <typename T>
+inline bool metric_is_per_device(T* metric)
+{
+    return true;
+}
+
 template <typename T>
 class nvml_measurement_thread {
 public:
@@ -22,40 +140,387 @@ public:
         last = system_clock_t::now();
     }
 
+    /** Called after each requested metric with all handles so far, only the new ones are added.
+     *  The handles live in a vector of the plugin, references to them are renewed if it was
+     *  reallocated, which happens only logarithmically often.
+     */
     void add_handles(const std::vector<nvml_t<T>>& handles)
     {
-        // only use handles from last call
-        measurements.clear();
-        for (auto& handle : handles) {
-            measurements.insert(std::make_pair(std::ref(const_cast<nvml_t<T>&>(handle)),
-                                               std::vector<pair_chrono_value_t>()));
+        if (handles.data() != handles_base) {
+            for (std::size_t i = 0; i < measurements.size(); ++i) {
+                measurements[i].first = std::ref(const_cast<nvml_t<T>&>(handles[positions[i]]));
+            }
+            handles_base = handles.data();
+        }
+
+        for (std::size_t i = slots.size(); i < handles.size(); ++i) {
+            auto& handle = handles[i];
+            if (handle.metric == nullptr) {
+                // metrics about the plugin itself
+                with_overhead = true;
+                slots.push_back(no_slot);
+                continue;
+            }
+            slots.push_back(measurements.size());
+            positions.push_back(i);
+            measurements.emplace_back(std::ref(const_cast<nvml_t<T>&>(handle)), handle_readings());
+            // handles of a metric of the node (e.g. sum(power_usage@*)) are bound to the first
+            // device in name only, losing it must not silence them, only their own backoff applies
+            if (metric_is_per_device(handle.metric)) {
+                device_state& device = device_states[handle.device];
+                device.index = handle.device_idx;
+                measurements.back().second.device = &device;
+            }
+            if (with_live) {
+                measurements.back().second.live = add_live_value(handle);
+            }
+            if (with_summary) {
+                measurements.back().second.summary = add_summary(handle);
+            }
+        }
+    }
+
+    // publish the latest value of every handle for the metrics endpoint, call before add_handles
+    void enable_live_values()
+    {
+        with_live = true;
+    }
+
+    /** Keep a summary of the values of every handle, written by write_summary. conditions are
+     *  thresholds whose duration is summed up. Without series only the summaries are kept.
+     *  Call before add_handles.
+     */
+    void enable_summary(const std::vector<trigger_condition>& conditions, bool series)
+    {
+        with_summary = true;
+        summary_conditions = conditions;
+        record_series = series;
+    }
+
+    /** Writes the summaries as JSON, after the measurement: one entry per handle and, for
+     *  metrics on several devices, one merged entry with device "all".
+     */
+    void write_summary(const std::string& path, const std::string& host)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::ofstream out(path);
+        if (!out) {
+            logging::warn() << "Could not write NVML summary to " << path;
+            return;
+        }
+        out.precision(15);
+        out << "{\n  \"host\": " << json_string(host) << ",\n  \"metrics\": [";
+
+        bool first_entry = true;
+        auto write_entry = [&](const nvml_t<T>& handle, const std::string& device,
+                               const value_summary& summary) {
+            out << (first_entry ? "" : ",") << "\n    {\"metric\": "
+                << json_string(handle.metric->get_name()) << ", \"device\": " << device
+                << ", \"unit\": " << json_string(handle.metric->get_unit()) << ", ";
+            summary.write_json(out);
+            out << "}";
+            first_entry = false;
+        };
+
+        // handles of a metric are registered one after another
+        for (std::size_t i = 0; i < measurements.size();) {
+            auto& handle = measurements[i].first.get();
+            std::size_t end = i;
+            while (end < measurements.size() &&
+                   measurements[end].first.get().metric == handle.metric) {
+                auto& other = measurements[end].first.get();
+                write_entry(other,
+                            metric_is_per_device(other.metric) ? std::to_string(other.device_idx)
+                                                               : std::string("null"),
+                            *measurements[end].second.summary);
+                ++end;
+            }
+            if (end - i > 1) {
+                value_summary all = *measurements[i].second.summary;
+                for (std::size_t j = i + 1; j < end; ++j) {
+                    all.merge(*measurements[j].second.summary);
+                }
+                write_entry(handle, "\"all\"", all);
+            }
+            i = end;
         }
+        out << "\n  ]\n}\n";
+        logging::info() << "Wrote NVML summary of " << measurements.size() << " series to " << path;
+    }
+
+    // stable once the measurement has started
+    const std::vector<std::unique_ptr<live_value>>& get_live_values()
+    {
+        // the endpoint needs the values of one metric family next to each other
+        std::stable_sort(live_values.begin(), live_values.end(),
+                         [](const std::unique_ptr<live_value>& a,
+                            const std::unique_ptr<live_value>& b) { return a->family < b->family; });
+        return live_values;
     }
 
     std::vector<pair_chrono_value_t> get_readings(nvml_t<T>& handle)
     {
         std::lock_guard<std::mutex> lock(m_mutex);
-        return measurements[handle];
+        if (handle.metric == nullptr) {
+            return overhead.get_series(handle.name);
+        }
+        handle_readings* readings = find_readings(handle);
+        if (readings == nullptr) {
+            return std::vector<pair_chrono_value_t>();
+        }
+        return readings->values;
+    }
+
+    // like get_readings, but moves the series out, for after the measurement
+    std::vector<pair_chrono_value_t> take_readings(nvml_t<T>& handle)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (handle.metric == nullptr) {
+            return overhead.get_series(handle.name);
+        }
+        std::vector<pair_chrono_value_t> values;
+        handle_readings* readings = find_readings(handle);
+        if (readings != nullptr) {
+            values.swap(readings->values);
+        }
+        return values;
+    }
+
+    // record overhead statistics even if no overhead metric was requested
+    void enable_overhead()
+    {
+        with_overhead = true;
+    }
+
+    void log_overhead_summary()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (with_overhead) {
+            overhead.log_summary();
+        }
+    }
+
+    // 0 disables periodic synchronisation
+    void set_sync_interval(std::chrono::milliseconds sync_interval_)
+    {
+        sync_interval = sync_interval_;
+    }
+
+    void set_timestamp_mode(timestamp_mode mode)
+    {
+        timestamps = mode;
+    }
+
+    /** Poll the devices of each NUMA node from a worker pinned next to them, the series are
+     *  then allocated there as well. devices as from nvml_topology, scope as from
+     *  thread_placement::numa_scope, call before the measurement.
+     */
+    void set_device_affinity(const std::vector<nvml_device_info>& devices, const std::vector<int>& scope)
+    {
+        numa_scope = scope;
+        for (auto& info : devices) {
+            auto it = device_states.find(info.device);
+            if (it != device_states.end()) {
+                it->second.numa_node = info.numa_node;
+                it->second.cpus = info.cpus;
+            }
+        }
+        numa_workers = true;
+    }
+
+    // requested metrics that are inputs of derived metrics only feed them, see setup_feeds
+    void set_suppress_inputs(bool suppress)
+    {
+        suppress_inputs = suppress;
+    }
+
+    /** Polls at multiples of the interval since the epoch of the system clock instead of
+     *  relative to the start, so the points of nodes with synchronised clocks line up.
+     */
+    void set_aligned(bool aligned_)
+    {
+        aligned = aligned_;
+    }
+
+    /** Triggered capture for measurement(): points are kept in a ring per handle covering pre,
+     *  and only committed from pre before until post after a condition fired on any handle.
+     *  Outside of these windows one point per coarse_interval is kept.
+     */
+    void set_trigger(const std::vector<trigger_condition>& conditions,
+                     std::chrono::milliseconds pre,
+                     std::chrono::milliseconds post,
+                     std::chrono::milliseconds coarse)
+    {
+        trigger_conditions = conditions;
+        trigger_pre = pre;
+        trigger_post = post;
+        coarse_interval = coarse;
+        triggered = true;
+    }
+
+    // synchronisation points recorded by the measurement, call after it finished
+    std::vector<sync_point_t> get_sync_points()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return sync_points;
     }
 
+    /** Polls every handle at its own interval (the interval of the metric or of the plugin).
+     *  Blocking metrics (e.g. PCIe throughput) are read by a second thread, so they do not
+     *  delay the others. With set_device_affinity the devices of each NUMA node are polled by
+     *  a worker of their own next to them.
+     */
     void measurement()
     {
         stop = false;
 
+        bool with_slow_lane = false;
+        steady_clock_t::time_point now = steady_clock_t::now();
+        for (auto& metric_it : measurements) {
+            auto& handle = metric_it.first.get();
+            auto& readings = metric_it.second;
+            readings.interval =
+                handle.metric->get_interval().count() > 0 ? handle.metric->get_interval() : interval;
+            readings.next_due = aligned ? next_grid_point(readings.interval) : now;
+            readings.slow_lane = handle.metric->is_blocking();
+            with_slow_lane |= readings.slow_lane;
+        }
+        setup_feeds();
+        if (triggered && !record_series) {
+            logging::warn() << "Triggers are ignored, only summaries are kept";
+            triggered = false;
+        }
+        if (triggered) {
+            setup_trigger();
+        }
+        std::vector<poll_worker> workers = assign_workers();
+
+        std::thread slow_lane;
+        if (with_slow_lane) {
+            // affinity and scheduling policy are inherited from this thread
+            slow_lane = std::thread([this]() { slow_lane_measurement(); });
+        }
+
+        // the first worker is this thread, the others inherit its scheduling policy
+        std::vector<std::thread> threads;
+        for (unsigned int worker = 1; worker < workers.size(); ++worker) {
+            threads.emplace_back([this, worker, &workers]() {
+                // devices without NUMA affinity share the worker of node -1
+                int numa_node = workers[worker].numa_node;
+                std::string name =
+                    "nvml-poll-" + (numa_node < 0 ? std::string("any") : std::to_string(numa_node));
+                pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+                place_near_device(workers[worker].cpus, workers[worker].numa_node, numa_scope);
+                poll(worker);
+            });
+        }
+        if (numa_workers) {
+            place_near_device(workers[0].cpus, workers[0].numa_node, numa_scope);
+        }
+        poll(0);
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if (slow_lane.joinable()) {
+            slow_lane.join();
+        }
+    }
+
+    /** Reads each handle of Hybrid_Metric from the sample buffer on the GPU (every
+     *  sampling_interval) or by polling (every interval), whichever the device supports.
+     *  Both are scheduled in this thread.
+     */
+    void hybrid_measurement(std::chrono::milliseconds sampling_interval)
+    {
+        stop = false;
+
+        unsigned long long start = std::chrono::duration_cast<std::chrono::microseconds>(
+                                       system_clock_t::now().time_since_epoch())
+                                       .count();
+        steady_clock_t::time_point now = steady_clock_t::now();
+        for (auto& metric_it : measurements) {
+            auto& handle = metric_it.first.get();
+            auto& readings = metric_it.second;
+            readings.sampled = handle.metric->is_sampled(handle.device);
+            readings.last_seen = start;
+            readings.interval = handle.metric->get_interval().count() > 0
+                                    ? handle.metric->get_interval()
+                                    : (readings.sampled ? sampling_interval : interval);
+            readings.next_due = aligned ? next_grid_point(readings.interval) : now;
+            logging::info() << "Reading " << handle
+                            << (readings.sampled ? " from the sample buffer" : " by polling");
+        }
+
+        std::vector<pair_time_sampling_t> samples;
+        std::vector<handle_readings*> swept;
         while (!stop) {
             try {
                 std::lock_guard<std::mutex> lock(m_mutex);
+
+                system_time_point_t sweep_begin = system_clock_t::now();
+                now = steady_clock_t::now();
+                if (with_overhead) {
+                    overhead_stats::begin_sweep(sweep);
+                }
+                swept.clear();
                 for (auto& metric_it : measurements) {
-                    std::uint64_t value = metric_it.first.get().metric->get_value(
-                        metric_it.first.get().device);
+                    auto& handle = metric_it.first.get();
+                    auto& readings = metric_it.second;
+                    if (!is_due(readings, now) || skip_failed(readings)) {
+                        continue;
+                    }
+
+                    if (readings.sampled) {
+                        read_samples(handle, readings, samples);
+                        continue;
+                    }
+
+                    Nvml_Metric* polled = handle.metric->get_polled();
+                    std::uint64_t value;
+                    nvmlReturn_t ret = timed_read(polled->get_api(), [&]() {
+                        return polled->read(handle.device, value);
+                    });
+                    if (!check_read(handle, readings, ret)) {
+                        continue;
+                    }
 
-                    metric_it.second.push_back(std::make_pair(system_clock_t::now(), value));
+                    system_time_point_t timestamp = timestamps == timestamp_mode::metric
+                                                        ? system_clock_t::now()
+                                                        : sweep_begin;
+                    if (!convert_counter(handle, readings, timestamp, value)) {
+                        continue;
+                    }
+                    record(readings, timestamp, value);
+                    swept.push_back(&readings);
                 }
+
+                if (timestamps == timestamp_mode::midpoint && record_series) {
+                    system_time_point_t midpoint =
+                        sweep_begin + (system_clock_t::now() - sweep_begin) / 2;
+                    for (auto readings : swept) {
+                        readings->values.back().first = midpoint;
+                    }
+                }
+
+                if (with_overhead) {
+                    overhead.end_sweep(sweep, sweep_begin);
+                }
+
+                synchronize(sweep_begin);
             }
             catch (scorep::exception::null_pointer& e) {
                 logging::warn() << "Score-P Clock not set.";
             }
-            std::this_thread::sleep_for(interval);
+            std::this_thread::sleep_until(next_wakeup(false));
+        }
+
+        // samples since the last read would be lost otherwise
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& metric_it : measurements) {
+            if (metric_it.second.sampled) {
+                read_samples(metric_it.first.get(), metric_it.second, samples);
+            }
         }
     }
 
@@ -67,11 +532,104 @@ public:
             do_sampling_measurement();
             last = system_clock_t::now();
 
+            try {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                synchronize(last);
+            }
+            catch (scorep::exception::null_pointer& e) {
+                logging::warn() << "Score-P Clock not set.";
+            }
+
             std::this_thread::sleep_for(interval);
         }
         do_sampling_measurement(); // on big intervals many points would be lost
     }
 
+    // blocks in nvmlEventSetWait and only records when the driver reports an event,
+    // interval is used as wait timeout to check for stop
+    void event_measurement()
+    {
+        nvmlEventSet_t event_set;
+        nvmlReturn_t ret = nvml_lib().nvmlEventSetCreate(&event_set);
+        if (NVML_SUCCESS != ret) {
+            logging::error() << "Could not create NVML event set, no events will be recorded. Code: "
+                             << nvml_lib().nvmlErrorString(ret);
+            return;
+        }
+
+        register_events(event_set);
+
+        stop = false;
+
+        record_initial_values();
+
+        unsigned int wait_failures = 0;
+        while (!stop) {
+            nvmlEventData_t event;
+            ret = nvml_lib().nvmlEventSetWait(event_set, &event, interval.count());
+
+            try {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                synchronize(system_clock_t::now());
+            }
+            catch (scorep::exception::null_pointer& e) {
+                logging::warn() << "Score-P Clock not set.";
+            }
+
+            if (NVML_ERROR_TIMEOUT == ret) {
+                continue;
+            }
+            if (NVML_SUCCESS != ret) {
+                // do not spin if the event set is broken
+                if (wait_failures++ == 0) {
+                    logging::warn() << "Waiting for NVML events failed. Code: "
+                                    << nvml_lib().nvmlErrorString(ret);
+                }
+                std::this_thread::sleep_for(interval);
+                continue;
+            }
+            wait_failures = 0;
+
+            try {
+                system_time_point_t timestamp = system_clock_t::now();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (with_overhead) {
+                    overhead_stats::begin_sweep(sweep);
+                }
+                for (auto& metric_it : measurements) {
+                    auto& handle = metric_it.first.get();
+                    if (handle.device != event.device ||
+                        !(handle.metric->get_event_type() & event.eventType)) {
+                        continue;
+                    }
+
+                    std::uint64_t value;
+                    ret = timed_read(handle.metric->get_api(), [&]() {
+                        return handle.metric->read(handle.device, event, value);
+                    });
+                    if (!check_read(handle, metric_it.second, ret)) {
+                        continue;
+                    }
+
+                    record(metric_it.second, timestamp, value);
+                }
+                if (with_overhead) {
+                    overhead.end_sweep(sweep, timestamp);
+                }
+            }
+            catch (scorep::exception::null_pointer& e) {
+                logging::warn() << "Score-P Clock not set.";
+            }
+        }
+
+        ret = nvml_lib().nvmlEventSetFree(event_set);
+        if (NVML_SUCCESS != ret) {
+            logging::warn() << "Could not free NVML event set. Code: "
+                            << nvml_lib().nvmlErrorString(ret);
+        }
+    }
+
     void stop_measurement()
     {
         std::lock_guard<std::mutex> lock(m_mutex);
@@ -90,37 +648,751 @@ protected:
             std::uint64_t unix_microseconds =
                 std::chrono::duration_cast<std::chrono::microseconds>(last.time_since_epoch())
                     .count();
+            std::vector<pair_time_sampling_t> sampling_values;
+
             std::lock_guard<std::mutex> lock(m_mutex);
+            if (with_overhead) {
+                overhead_stats::begin_sweep(sweep);
+            }
             for (auto& metric_it : measurements) {
-                std::vector<pair_time_sampling_t> sampling_values =
-                    metric_it.first.get().metric->get_value(
-                        metric_it.first.get().device, unix_microseconds);
+                auto& handle = metric_it.first.get();
+                auto& readings = metric_it.second;
+                if (skip_failed(readings)) {
+                    continue;
+                }
+
+                sampling_values.clear();
+                nvmlReturn_t ret = timed_read(handle.metric->get_api(), [&]() {
+                    return handle.metric->read(handle.device, unix_microseconds, sampling_values);
+                });
+                if (!check_read(handle, readings, ret)) {
+                    continue;
+                }
 
                 for (auto& pair_it : sampling_values) {
                     system_time_point_t chrono_timestamp =
                         system_time_point_t() +
                         std::chrono::microseconds(pair_it.first);
 
-                    metric_it.second.push_back(std::make_pair(
-                        chrono_timestamp, (std::uint64_t)pair_it.second));
+                    record(readings, chrono_timestamp, (std::uint64_t)pair_it.second);
                 }
             }
+            if (with_overhead) {
+                overhead.end_sweep(sweep, system_clock_t::now());
+            }
         }
         catch (scorep::exception::null_pointer& e) {
             logging::warn() << "Score-P Clock not set.";
         }
     }
 
+    // a read of poll(), recorded after the sweep
+    struct polled_read {
+        nvml_t<T>* handle;
+        handle_readings* readings;
+        nvmlReturn_t ret;
+        std::uint64_t value;
+        system_time_point_t timestamp;
+        std::uint64_t duration;
+    };
+
+    /** Sweeps over the handles of worker until stop, see measurement(). NVML is read without
+     *  m_mutex, like in the slow lane, and the reads are recorded at the end of the sweep, so
+     *  the workers of different NUMA nodes do not wait for each other.
+     *  The schedule and backoff of a handle are only used by its worker.
+     */
+    void poll(unsigned int worker)
+    {
+        overhead_stats::sweep sweep;
+        std::vector<polled_read> reads;
+        std::vector<handle_readings*> swept;
+        while (!stop) {
+            system_time_point_t sweep_begin = system_clock_t::now();
+            steady_clock_t::time_point now = steady_clock_t::now();
+            if (with_overhead) {
+                overhead_stats::begin_sweep(sweep);
+            }
+            reads.clear();
+            for (std::size_t i : read_order) {
+                auto& handle = measurements[i].first.get();
+                auto& readings = measurements[i].second;
+                if (readings.slow_lane || readings.worker != worker || !is_due(readings, now) ||
+                    skip_failed(readings)) {
+                    continue;
+                }
+
+                polled_read read{ &handle, &readings, NVML_SUCCESS, 0, sweep_begin, 0 };
+                auto begin = with_overhead ? overhead_stats::clock::now()
+                                           : overhead_stats::clock::time_point();
+                read.ret = handle.metric->read(handle.device, read.value);
+                if (with_overhead) {
+                    read.duration = overhead_stats::since(begin);
+                }
+                if (timestamps == timestamp_mode::metric) {
+                    read.timestamp = system_clock_t::now();
+                }
+                for (auto& feed : readings.feeds) {
+                    feed.first->feed(feed.second, handle.device, read.ret, read.value, read.timestamp);
+                }
+                reads.push_back(read);
+            }
+            system_time_point_t sweep_end = system_clock_t::now();
+
+            try {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                swept.clear();
+                for (auto& read : reads) {
+                    auto& handle = *read.handle;
+                    auto& readings = *read.readings;
+                    if (with_overhead) {
+                        overhead.record_call(handle.metric->get_api(), read.duration, &sweep);
+                    }
+                    if (!check_read(handle, readings, read.ret) || readings.suppressed ||
+                        !convert_counter(handle, readings, read.timestamp, read.value)) {
+                        continue;
+                    }
+                    if (triggered) {
+                        capture(handle, readings, read.timestamp, read.value);
+                        continue;
+                    }
+                    record(readings, read.timestamp, read.value);
+                    swept.push_back(&readings);
+                }
+
+                if (timestamps == timestamp_mode::midpoint && record_series) {
+                    system_time_point_t midpoint = sweep_begin + (sweep_end - sweep_begin) / 2;
+                    for (auto readings : swept) {
+                        readings->values.back().first = midpoint;
+                    }
+                }
+
+                if (with_overhead) {
+                    // the workers of NUMA nodes take turns here, stamped now their points stay
+                    // in order in the shared series
+                    overhead.end_sweep(sweep, numa_workers ? system_clock_t::now() : sweep_begin);
+                }
+
+                synchronize(sweep_begin);
+            }
+            catch (scorep::exception::null_pointer& e) {
+                logging::warn() << "Score-P Clock not set.";
+            }
+            std::this_thread::sleep_until(next_wakeup(false, worker));
+        }
+    }
+
+    /** One worker per NUMA node of the polled devices with set_device_affinity, a single one
+     *  otherwise. Sets the worker of each handle.
+     */
+    std::vector<poll_worker> assign_workers()
+    {
+        std::vector<poll_worker> workers;
+        if (!numa_workers) {
+            workers.emplace_back();
+            return workers;
+        }
+        for (auto& metric_it : measurements) {
+            auto& readings = metric_it.second;
+            if (readings.slow_lane || readings.device == nullptr) {
+                continue;
+            }
+            int numa_node = readings.device->numa_node;
+            auto it = std::find_if(workers.begin(), workers.end(), [numa_node](const poll_worker& w) {
+                return w.numa_node == numa_node;
+            });
+            if (it == workers.end()) {
+                workers.push_back(poll_worker{ numa_node, readings.device->cpus });
+                it = workers.end() - 1;
+            }
+            readings.worker = it - workers.begin();
+        }
+        if (workers.empty()) {
+            workers.emplace_back();
+        }
+        for (auto& worker : workers) {
+            logging::info() << "Polling devices of NUMA node " << worker.numa_node << " from "
+                            << worker.cpus.size() << " close CPUs";
+        }
+        return workers;
+    }
+
+    // reads the blocking metrics of measurement() one after another without holding m_mutex
+    // during the NVML call, each point is timestamped on its own
+    void slow_lane_measurement()
+    {
+        pthread_setname_np(pthread_self(), "nvml-poll-slow");
+
+        while (!stop) {
+            for (std::size_t i : read_order) {
+                auto& handle = measurements[i].first.get();
+                auto& readings = measurements[i].second;
+                // schedule and backoff of slow handles are only used by this thread
+                if (!readings.slow_lane || !is_due(readings, steady_clock_t::now()) ||
+                    skip_failed(readings)) {
+                    continue;
+                }
+
+                system_time_point_t read_begin = system_clock_t::now();
+                auto begin = overhead_stats::clock::now();
+                std::uint64_t value;
+                nvmlReturn_t ret = handle.metric->read(handle.device, value);
+                std::uint64_t duration = overhead_stats::since(begin);
+                system_time_point_t read_end = system_clock_t::now();
+
+                system_time_point_t timestamp = read_end;
+                if (timestamps == timestamp_mode::sweep) {
+                    timestamp = read_begin;
+                }
+                else if (timestamps == timestamp_mode::midpoint) {
+                    timestamp = read_begin + (read_end - read_begin) / 2;
+                }
+                for (auto& feed : readings.feeds) {
+                    feed.first->feed(feed.second, handle.device, ret, value, timestamp);
+                }
+
+                try {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (with_overhead) {
+                        overhead.record_call(handle.metric->get_api(), duration);
+                    }
+                    if (!check_read(handle, readings, ret) || readings.suppressed ||
+                        !convert_counter(handle, readings, timestamp, value)) {
+                        continue;
+                    }
+                    if (triggered) {
+                        capture(handle, readings, timestamp, value);
+                    }
+                    else {
+                        record(readings, timestamp, value);
+                    }
+                }
+                catch (scorep::exception::null_pointer& e) {
+                    logging::warn() << "Score-P Clock not set.";
+                }
+            }
+            std::this_thread::sleep_until(next_wakeup(true));
+        }
+    }
+
+    /** Inputs of derived metrics that are requested as well are fed from the reads of their
+     *  handles instead of read again, so these are read first (read_order). With
+     *  suppress_inputs such handles are not recorded.
+     */
+    void setup_feeds()
+    {
+        std::vector<Derived_Metric*> derived;
+        for (auto& metric_it : measurements) {
+            auto metric = dynamic_cast<Derived_Metric*>(metric_it.first.get().metric);
+            if (metric != nullptr && std::find(derived.begin(), derived.end(), metric) == derived.end()) {
+                derived.push_back(metric);
+            }
+        }
+
+        read_order.clear();
+        std::vector<std::size_t> derived_handles;
+        for (std::size_t i = 0; i < measurements.size(); ++i) {
+            auto& handle = measurements[i].first.get();
+            auto& readings = measurements[i].second;
+            if (dynamic_cast<Derived_Metric*>(handle.metric) != nullptr) {
+                derived_handles.push_back(i);
+                continue;
+            }
+            read_order.push_back(i);
+            readings.feeds.clear();
+            for (auto metric : derived) {
+                int input = metric->feed_input(handle.metric->get_name(), handle.device);
+                if (input >= 0) {
+                    readings.feeds.emplace_back(metric, input);
+                }
+            }
+            readings.suppressed = suppress_inputs && !readings.feeds.empty();
+            if (readings.suppressed) {
+                logging::info() << "Not recording " << handle << ", it only feeds derived metrics";
+            }
+        }
+        read_order.insert(read_order.end(), derived_handles.begin(), derived_handles.end());
+    }
+
+    // true if the handle has to be read now, then schedules its next read. Slots that were
+    // missed (e.g. after a long read) are dropped instead of read in a burst.
+    inline bool is_due(handle_readings& readings, steady_clock_t::time_point now)
+    {
+        if (now < readings.next_due) {
+            return false;
+        }
+        if (aligned) {
+            readings.next_due = next_grid_point(readings.interval);
+            return true;
+        }
+        readings.next_due += readings.interval;
+        if (readings.next_due <= now) {
+            readings.next_due = now + readings.interval;
+        }
+        return true;
+    }
+
+    /** The next multiple of period on the system clock, as time point of the steady clock.
+     *  Recomputed for every read, so adjustments of the system clock are followed. Called when
+     *  a grid point is due, which may be shortly before it on the system clock, so the result
+     *  is at least half a period ahead.
+     */
+    inline steady_clock_t::time_point next_grid_point(std::chrono::milliseconds period)
+    {
+        steady_clock_t::time_point now = steady_clock_t::now();
+        // an interval of 0 has no grid
+        if (period.count() == 0) {
+            return now;
+        }
+        auto remaining = period - system_clock_t::now().time_since_epoch() % period;
+        if (remaining < period / 2) {
+            remaining += period;
+        }
+        return now + remaining;
+    }
+
+    // earliest next read of a lane (and polling worker), at most one plugin interval ahead
+    // so stop is noticed
+    inline steady_clock_t::time_point next_wakeup(bool slow_lane, unsigned int worker = 0)
+    {
+        steady_clock_t::time_point wakeup = steady_clock_t::now() + interval;
+        for (auto& metric_it : measurements) {
+            auto& readings = metric_it.second;
+            if (readings.slow_lane == slow_lane && (slow_lane || readings.worker == worker) &&
+                readings.next_due < wakeup) {
+                wakeup = readings.next_due;
+            }
+        }
+        return wakeup;
+    }
+
+    // appends the samples of a hybrid handle newer than the newest one seen,
+    // timestamps are those of the samples
+    inline void read_samples(nvml_t<T>& handle,
+                             handle_readings& readings,
+                             std::vector<pair_time_sampling_t>& samples)
+    {
+        Nvml_Sampling_Metric* sampled = handle.metric->get_sampled();
+        samples.clear();
+        nvmlReturn_t ret = timed_read(sampled->get_api(), [&]() {
+            return sampled->read(handle.device, readings.last_seen, samples);
+        });
+        if (!check_read(handle, readings, ret)) {
+            return;
+        }
+
+        for (auto& sample : samples) {
+            if (sample.first <= readings.last_seen) {
+                continue;
+            }
+            record(readings, system_time_point_t() + std::chrono::microseconds(sample.first),
+                   sample.second);
+        }
+        for (auto& sample : samples) {
+            readings.last_seen = std::max(readings.last_seen, sample.first);
+        }
+    }
+
+    // handle is normally one of the plugin's handles, copies are looked up by name and device
+    handle_readings* find_readings(const nvml_t<T>& handle)
+    {
+        std::less<const nvml_t<T>*> before;
+        if (handles_base != nullptr && !before(&handle, handles_base) &&
+            before(&handle, handles_base + slots.size())) {
+            std::size_t slot = slots[&handle - handles_base];
+            if (slot != no_slot) {
+                return &measurements[slot].second;
+            }
+        }
+        for (auto& metric_it : measurements) {
+            if (metric_it.first.get() == handle) {
+                return &metric_it.second;
+            }
+        }
+        return nullptr;
+    }
+
+    // metric families are nvml_<metric>, derived metrics are nvml_derived{expression="..."}
+    live_value* add_live_value(const nvml_t<T>& handle)
+    {
+        const std::string& metric_name = handle.metric->get_name();
+        std::string family = "nvml_" + metric_name;
+        std::string labels;
+        if (metric_name.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789_") !=
+            std::string::npos) {
+            family = "nvml_derived";
+            labels = "expression=\"" + metric_name + "\"";
+        }
+        if (metric_is_per_device(handle.metric)) {
+            labels += std::string(labels.empty() ? "" : ",") + "device=\"" +
+                      std::to_string(handle.device_idx) + "\"";
+        }
+
+        std::string help = handle.metric->get_desc();
+        if (!handle.metric->get_unit().empty()) {
+            help += " in " + handle.metric->get_unit();
+        }
+
+        live_values.emplace_back(
+            new live_value(family, help, labels, handle.metric->get_datatype() == DOUBLE));
+        return live_values.back().get();
+    }
+
+    // summary of the values of handle, with the conditions on its metric
+    value_summary* add_summary(const nvml_t<T>& handle)
+    {
+        summaries.emplace_back(new value_summary(handle.metric->get_datatype()));
+        for (auto& condition : summary_conditions) {
+            if (condition.metric == handle.metric->get_name()) {
+                summaries.back()->add_condition(condition);
+            }
+        }
+        return summaries.back().get();
+    }
+
+    // appends a point and observes it
+    inline void record(handle_readings& readings, system_time_point_t timestamp, std::uint64_t value)
+    {
+        if (record_series) {
+            readings.values.push_back(std::make_pair(timestamp, value));
+        }
+        observe(readings, timestamp, value);
+    }
+
+    // publishes a point as latest value of the handle and adds it to its summary
+    inline void observe(handle_readings& readings, system_time_point_t timestamp, std::uint64_t value)
+    {
+        if (readings.live != nullptr) {
+            readings.live->publish(value, std::chrono::duration_cast<std::chrono::microseconds>(
+                                              timestamp.time_since_epoch())
+                                              .count());
+        }
+        if (readings.summary != nullptr) {
+            readings.summary->add(timestamp, value);
+        }
+    }
+
+    // conditions to the handles of their metric, rings sized to cover trigger_pre
+    void setup_trigger()
+    {
+        if (timestamps == timestamp_mode::midpoint) {
+            logging::warn() << "Timestamp mode midpoint is not supported with triggers, using sweep";
+            timestamps = timestamp_mode::sweep;
+        }
+        for (auto& condition : trigger_conditions) {
+            bool used = false;
+            for (auto& metric_it : measurements) {
+                if (metric_it.first.get().metric->get_name() == condition.metric) {
+                    metric_it.second.triggers.push_back(condition);
+                    used = true;
+                }
+            }
+            if (!used) {
+                logging::warn() << "Trigger on " << condition.metric
+                                << " is ignored, the metric is not measured";
+            }
+        }
+        for (auto& metric_it : measurements) {
+            auto& readings = metric_it.second;
+            // an interval of 0 polls as fast as possible, the ring holds at least 1ms apart
+            std::chrono::milliseconds spacing =
+                std::max(readings.interval, std::chrono::milliseconds(1));
+            readings.ring.resize(trigger_pre / spacing + 1);
+        }
+    }
+
+    // triggered capture of a point, see set_trigger, needs m_mutex to be held
+    inline void capture(const nvml_t<T>& handle,
+                        handle_readings& readings,
+                        system_time_point_t timestamp,
+                        std::uint64_t value)
+    {
+        double number = handle.metric->get_datatype() == DOUBLE ? bits_to_double(value) : value;
+        bool fired = false;
+        for (auto& condition : readings.triggers) {
+            fired |= condition.fires(number);
+        }
+        if (fired) {
+            if (timestamp >= window_end) {
+                // the window starts, commit what led to it
+                for (auto& metric_it : measurements) {
+                    metric_it.second.ring.commit(metric_it.second.values);
+                }
+            }
+            window_end = std::max(window_end, timestamp + trigger_post);
+        }
+
+        if (timestamp < window_end) {
+            record(readings, timestamp, value);
+            return;
+        }
+        if (timestamp >= readings.next_coarse) {
+            record(readings, timestamp, value);
+            readings.next_coarse = timestamp + coarse_interval;
+        }
+        else {
+            observe(readings, timestamp, value);
+        }
+        readings.ring.push(timestamp, value);
+    }
+
+    // records a synchronisation point if the last one is older than sync_interval,
+    // needs m_mutex to be held
+    inline void synchronize(system_time_point_t now)
+    {
+        if (sync_interval.count() == 0 ||
+            (!sync_points.empty() && now - sync_points.back().first < sync_interval)) {
+            return;
+        }
+        system_time_point_t local = system_clock_t::now();
+        sync_points.emplace_back(local, scorep::chrono::measurement_clock::now());
+    }
+
+    // times the NVML call in read if overhead statistics are enabled
+    template <typename Read>
+    inline nvmlReturn_t timed_read(const char* api, Read read)
+    {
+        if (!with_overhead) {
+            return read();
+        }
+        auto begin = overhead_stats::clock::now();
+        nvmlReturn_t ret = read();
+        overhead.record_call(api, overhead_stats::since(begin), &sweep);
+        return ret;
+    }
+
+    // replaces the raw value of counter metrics by rate or total, false if there is no value yet
+    inline bool convert_counter(const nvml_t<T>& handle,
+                                handle_readings& readings,
+                                system_time_point_t timestamp,
+                                std::uint64_t& value)
+    {
+        unsigned int bits = handle.metric->get_counter_bits();
+        if (bits == 0) {
+            return true;
+        }
+        return readings.counter.update(value, timestamp, bits, handle.metric->get_counter_scale(),
+                                       handle.metric->get_measure_type() == ABS, value);
+    }
+
+    // true if the handle is still backing off after failed reads or its device is quarantined
+    inline bool skip_failed(handle_readings& readings)
+    {
+        if (readings.device != nullptr && readings.device->lost.load(std::memory_order_relaxed) &&
+            steady_clock_t::now().time_since_epoch().count() <
+                readings.device->retry_at.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        if (readings.skip == 0) {
+            return false;
+        }
+        --readings.skip;
+        return true;
+    }
+
+    // counts failed reads and sets the number of sweeps to skip, warns on the first
+    // failure and then only each time the failure count doubles
+    inline bool check_read(const nvml_t<T>& handle, handle_readings& readings, nvmlReturn_t ret)
+    {
+        if (NVML_SUCCESS == ret) {
+            readings.failures = 0;
+            if (readings.device != nullptr && readings.device->lost.load(std::memory_order_relaxed)) {
+                logging::info() << "CUDA device " << readings.device->index
+                                << " answers again, its metrics are read again";
+                readings.device->lost.store(false, std::memory_order_relaxed);
+            }
+            return true;
+        }
+
+        if ((NVML_ERROR_GPU_IS_LOST == ret || NVML_ERROR_RESET_REQUIRED == ret) &&
+            readings.device != nullptr) {
+            quarantine(*readings.device, ret);
+            return false;
+        }
+
+        ++readings.failures;
+        unsigned int shift = readings.failures - 1 < max_backoff_shift
+                                 ? readings.failures - 1
+                                 : max_backoff_shift;
+        readings.skip = (1u << shift) - 1;
+
+        if ((readings.failures & (readings.failures - 1)) == 0) {
+            logging::warn() << "Reading " << handle << " failed " << readings.failures
+                            << " time(s) in a row. Code: " << nvml_lib().nvmlErrorString(ret);
+        }
+        return false;
+    }
+
+    // stops reading a lost device until retry_at and marks the gap in the series of its handles
+    void quarantine(device_state& device, nvmlReturn_t ret)
+    {
+        if (!device.lost.load(std::memory_order_relaxed)) {
+            logging::warn() << "CUDA device " << device.index
+                            << " is lost, its metrics are not read until it answers again. Code: "
+                            << nvml_lib().nvmlErrorString(ret);
+            device.probes = 0;
+            device.lost.store(true, std::memory_order_relaxed);
+            mark_gap(device, system_clock_t::now());
+        }
+
+        unsigned int shift =
+            device.probes < max_quarantine_shift ? device.probes : max_quarantine_shift;
+        ++device.probes;
+        device.retry_at.store(
+            (steady_clock_t::now() + std::chrono::seconds(1u << shift)).time_since_epoch().count(),
+            std::memory_order_relaxed);
+    }
+
+    // a zero (NaN for double metrics) in every series of device at the start of the gap.
+    // Accumulated series get no marker, a zero would make their counter go backwards.
+    void mark_gap(device_state& device, system_time_point_t timestamp)
+    {
+        for (auto& metric_it : measurements) {
+            if (metric_it.second.device != &device) {
+                continue;
+            }
+            auto& readings = metric_it.second;
+            // the marker is no value
+            if (readings.summary != nullptr) {
+                readings.summary->interrupt();
+            }
+            if (metric_it.first.get().metric->get_measure_type() == ACCU) {
+                continue;
+            }
+            bool as_double = metric_it.first.get().metric->get_datatype() == DOUBLE;
+            std::uint64_t marker = as_double ? double_to_bits(NAN) : 0;
+            if (record_series) {
+                readings.values.push_back(std::make_pair(timestamp, marker));
+            }
+            // triggered: kept like a coarse point of capture, without testing the conditions, so
+            // that a window opened later still commits the ring in order
+            if (triggered && timestamp >= window_end) {
+                readings.ring.push(timestamp, marker);
+            }
+            if (readings.live != nullptr) {
+                readings.live->publish(marker, std::chrono::duration_cast<std::chrono::microseconds>(
+                                                   timestamp.time_since_epoch())
+                                                   .count());
+            }
+        }
+    }
+
+    // register the union of all requested event types per device,
+    // event types the device does not support are dropped with a warning
+    void register_events(nvmlEventSet_t event_set)
+    {
+        std::unordered_map<nvmlDevice_t, unsigned long long> device_events;
+        for (auto& metric_it : measurements) {
+            auto& handle = metric_it.first.get();
+            device_events[handle.device] |= handle.metric->get_event_type();
+        }
+
+        for (auto& device_it : device_events) {
+            unsigned long long supported;
+            nvmlReturn_t ret =
+                nvml_lib().nvmlDeviceGetSupportedEventTypes(device_it.first, &supported);
+            if (NVML_SUCCESS != ret) {
+                logging::warn() << "Could not query supported NVML event types. Code: "
+                                << nvml_lib().nvmlErrorString(ret);
+                continue;
+            }
+
+            unsigned long long events = device_it.second & supported;
+            if (events != device_it.second) {
+                logging::warn() << "NVML event types 0x" << std::hex
+                                << (device_it.second & ~supported) << std::dec
+                                << " are not supported on device, no values will be recorded for them";
+            }
+            if (events == nvmlEventTypeNone) {
+                continue;
+            }
+
+            ret = nvml_lib().nvmlDeviceRegisterEvents(device_it.first, events, event_set);
+            if (NVML_SUCCESS != ret) {
+                logging::warn() << "Could not register NVML events. Code: "
+                                << nvml_lib().nvmlErrorString(ret);
+            }
+        }
+    }
+
+    // state metrics get one point at start so the series does not begin at the first change
+    void record_initial_values()
+    {
+        system_time_point_t timestamp = system_clock_t::now();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& metric_it : measurements) {
+            auto& handle = metric_it.first.get();
+            if (!handle.metric->has_state()) {
+                continue;
+            }
+
+            nvmlEventData_t event = {};
+            event.device = handle.device;
+            std::uint64_t value;
+            nvmlReturn_t ret = handle.metric->read(handle.device, event, value);
+            if (check_read(handle, metric_it.second, ret)) {
+                record(metric_it.second, timestamp, value);
+            }
+        }
+    }
+
 protected:
+    // a failing handle is retried at least every 2^max_backoff_shift sweeps
+    static constexpr unsigned int max_backoff_shift = 6;
+    // a lost device is probed at least every 2^max_quarantine_shift seconds
+    static constexpr unsigned int max_quarantine_shift = 6;
+
     std::chrono::milliseconds interval;
+    std::chrono::milliseconds sync_interval = std::chrono::milliseconds(0);
+
+    timestamp_mode timestamps = timestamp_mode::metric;
+    bool aligned = false;
+    bool numa_workers = false;
+    std::vector<int> numa_scope;
 
     std::mutex m_mutex;
 
-    bool stop = true;
+    // read by both lanes of measurement()
+    std::atomic<bool> stop{ true };
 
     system_time_point_t last;
 
-    std::unordered_map<std::reference_wrapper<nvml_t<T>>, std::vector<pair_chrono_value_t>, std::hash<nvml_t<T>>, std::equal_to<nvml_t<T>>> measurements;
+    std::vector<sync_point_t> sync_points;
+
+    bool with_overhead = false;
+    overhead_stats overhead;
+    // of the single thread of hybrid, sampling and event measurement
+    overhead_stats::sweep sweep;
+
+    bool with_live = false;
+    std::vector<std::unique_ptr<live_value>> live_values;
+
+    bool with_summary = false;
+    std::vector<trigger_condition> summary_conditions;
+    std::vector<std::unique_ptr<value_summary>> summaries;
+    // false if only summaries are kept
+    bool record_series = true;
+
+    bool triggered = false;
+    std::vector<trigger_condition> trigger_conditions;
+    std::chrono::milliseconds trigger_pre{ 0 };
+    std::chrono::milliseconds trigger_post{ 0 };
+    std::chrono::milliseconds coarse_interval{ 0 };
+    // end of the current capture window
+    system_time_point_t window_end;
+
+    std::vector<std::pair<std::reference_wrapper<nvml_t<T>>, handle_readings>> measurements;
+    // positions in measurements, inputs of derived metrics before these, see setup_feeds
+    std::vector<std::size_t> read_order;
+    bool suppress_inputs = false;
+    // map nodes are stable, handle_readings point to them
+    std::map<nvmlDevice_t, device_state> device_states;
+
+    // index in the handles of the plugin for each measurement, and the reverse
+    enum : std::size_t { no_slot = static_cast<std::size_t>(-1) };
+    std::vector<std::size_t> positions;
+    std::vector<std::size_t> slots;
+    const nvml_t<T>* handles_base = nullptr;
 };
 
 #endif // SCOREP_PLUGIN_NVML_NVML_MEASUREMENT_THREAD_HPP
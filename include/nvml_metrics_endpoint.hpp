@@ -0,0 +1,275 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_METRICS_ENDPOINT_HPP
+#define SCOREP_PLUGIN_NVML_NVML_METRICS_ENDPOINT_HPP
+
+#include "nvml_live_value.hpp"
+#include "nvml_wrapper.hpp"
+
+#include <scorep/plugin/plugin.hpp>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using scorep::plugin::logging;
+
+/** Serves the latest value of every handle in OpenMetrics text format on GET /metrics,
+ *  e.g. for a node exporter. Listens on the loopback interface only ("9400" or
+ *  "localhost:9400") or on a Unix socket ("unix:/path/to/socket").
+ *  Scrapes read the live values without locks and never block the measurement.
+ */
+class metrics_endpoint {
+public:
+    metrics_endpoint(const std::string& address_,
+                     const std::vector<std::unique_ptr<live_value>>& values_)
+        : address(address_), values(values_)
+    {
+    }
+
+    ~metrics_endpoint()
+    {
+        stop();
+    }
+
+    metrics_endpoint(const metrics_endpoint&) = delete;
+    metrics_endpoint& operator=(const metrics_endpoint&) = delete;
+
+    // failing to listen only results in a warning, the measurement is not affected
+    void start()
+    {
+        listen_fd = open_socket();
+        if (listen_fd < 0) {
+            return;
+        }
+        if (pipe(stop_pipe) != 0) {
+            logging::warn() << "Could not start metrics endpoint: " << std::strerror(errno);
+            close(listen_fd);
+            listen_fd = -1;
+            return;
+        }
+        server = std::thread([this]() { serve(); });
+        logging::info() << "Serving NVML metrics on " << address;
+    }
+
+    void stop()
+    {
+        if (!server.joinable()) {
+            return;
+        }
+        char c = 0;
+        if (write(stop_pipe[1], &c, 1) != 1) {
+            logging::warn() << "Could not stop metrics endpoint: " << std::strerror(errno);
+        }
+        server.join();
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        close(listen_fd);
+        listen_fd = -1;
+        if (address.compare(0, 5, "unix:") == 0) {
+            unlink(address.substr(5).c_str());
+        }
+    }
+
+private:
+    int open_socket()
+    {
+        int fd;
+        if (address.compare(0, 5, "unix:") == 0) {
+            sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            std::string path = address.substr(5);
+            if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+                logging::warn() << "Invalid Unix socket path for metrics endpoint: " << path;
+                return -1;
+            }
+            std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            // a stale socket of a previous run would make bind fail
+            unlink(path.c_str());
+
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                return socket_failed(fd);
+            }
+        }
+        else {
+            std::string port = address;
+            std::size_t colon = address.rfind(':');
+            if (colon != std::string::npos) {
+                std::string host = address.substr(0, colon);
+                if (host != "localhost" && host != "127.0.0.1") {
+                    logging::warn() << "Metrics endpoint only listens on localhost, not on " << host;
+                    return -1;
+                }
+                port = address.substr(colon + 1);
+            }
+
+            sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            try {
+                addr.sin_port = htons(static_cast<std::uint16_t>(std::stoul(port)));
+            }
+            catch (std::exception&) {
+                logging::warn() << "Invalid port for metrics endpoint: " << port;
+                return -1;
+            }
+
+            fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            int one = 1;
+            if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+                bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                return socket_failed(fd);
+            }
+        }
+
+        if (listen(fd, 4) != 0) {
+            return socket_failed(fd);
+        }
+        return fd;
+    }
+
+    int socket_failed(int fd)
+    {
+        logging::warn() << "Could not listen for metrics endpoint on " << address << ": "
+                        << std::strerror(errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    void serve()
+    {
+        pthread_setname_np(pthread_self(), "nvml-metrics");
+
+        while (true) {
+            pollfd fds[2] = { { listen_fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                logging::warn() << "Metrics endpoint stopped: " << std::strerror(errno);
+                return;
+            }
+            if (fds[1].revents != 0) {
+                return;
+            }
+            if (fds[0].revents & POLLIN) {
+                int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client >= 0) {
+                    handle_request(client);
+                    close(client);
+                }
+            }
+        }
+    }
+
+    // one request per connection, slow clients are dropped after a second
+    void handle_request(int client)
+    {
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            pollfd fd = { client, POLLIN, 0 };
+            if (poll(&fd, 1, 1000) <= 0) {
+                return;
+            }
+            ssize_t n = read(client, buffer, sizeof(buffer));
+            if (n <= 0) {
+                return;
+            }
+            request.append(buffer, n);
+        }
+
+        std::string status = "200 OK";
+        std::string content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+        std::string body;
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 14, "GET /metrics?") == 0) {
+            body = format_metrics();
+        }
+        else {
+            status = "404 Not Found";
+            content_type = "text/plain";
+            body = "Only GET /metrics is served\n";
+        }
+
+        std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: " + content_type +
+                               "\r\nContent-Length: " + std::to_string(body.size()) +
+                               "\r\nConnection: close\r\n\r\n" + body;
+        std::size_t sent = 0;
+        while (sent < response.size()) {
+            ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return;
+            }
+            sent += n;
+        }
+    }
+
+    // values are grouped by family, as the live values are created sorted by it
+    std::string format_metrics() const
+    {
+        std::ostringstream out;
+        out.precision(17);
+        const std::string* family = nullptr;
+        for (auto& value : values) {
+            if (family == nullptr || *family != value->family) {
+                family = &value->family;
+                out << "# TYPE " << value->family << " gauge\n"
+                    << "# HELP " << value->family << " " << value->help << "\n";
+            }
+
+            std::uint64_t latest;
+            std::int64_t time_us;
+            if (!value->read(latest, time_us)) {
+                continue;
+            }
+            out << value->family;
+            if (!value->labels.empty()) {
+                out << "{" << value->labels << "}";
+            }
+            out << " ";
+            if (!value->is_double) {
+                out << latest;
+            }
+            else if (std::isnan(bits_to_double(latest))) {
+                out << "NaN";
+            }
+            else {
+                out << bits_to_double(latest);
+            }
+            // timestamps are seconds since the epoch
+            char timestamp[32];
+            std::snprintf(timestamp, sizeof(timestamp), "%lld.%06lld",
+                          static_cast<long long>(time_us / 1000000),
+                          static_cast<long long>(time_us % 1000000));
+            out << " " << timestamp << "\n";
+        }
+        out << "# EOF\n";
+        return out.str();
+    }
+
+    std::string address;
+    const std::vector<std::unique_ptr<live_value>>& values;
+
+    int listen_fd = -1;
+    int stop_pipe[2] = { -1, -1 };
+    std::thread server;
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_METRICS_ENDPOINT_HPP
@@ -0,0 +1,148 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_OVERHEAD_HPP
+#define SCOREP_PLUGIN_NVML_NVML_OVERHEAD_HPP
+
+#include "nvml_histogram.hpp"
+#include "nvml_types.hpp"
+
+#include <scorep/plugin/plugin.hpp>
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using scorep::plugin::logging;
+
+/** Names of the metrics about the plugin itself, available in the asynchronous plugins
+ */
+inline bool is_overhead_metric(const std::string& metric_name)
+{
+    return metric_name == "overhead_sweep_time" || metric_name == "overhead_nvml_time" ||
+           metric_name == "overhead_cpu_time";
+}
+
+inline scorep::plugin::metric_property overhead_metric_property(const std::string& metric_name)
+{
+    if (metric_name == "overhead_sweep_time") {
+        scorep::plugin::metric_property property(metric_name, "Duration of one measurement sweep",
+                                                 "ns");
+        property.absolute_point();
+        property.value_uint();
+        return property;
+    }
+    if (metric_name == "overhead_nvml_time") {
+        scorep::plugin::metric_property property(metric_name,
+                                                 "Time spent in NVML calls per sweep", "ns");
+        property.absolute_point();
+        property.value_uint();
+        return property;
+    }
+    scorep::plugin::metric_property property(metric_name, "CPU time of the measurement thread",
+                                             "ns");
+    property.accumulated_point();
+    property.value_uint();
+    return property;
+}
+
+/** Cost of the measurement itself: latency of each NVML entry point, duration of sweeps
+ *  and CPU time of the measurement thread
+ */
+class overhead_stats {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static std::uint64_t since(clock::time_point begin)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin).count();
+    }
+
+    static std::uint64_t thread_cpu_time()
+    {
+        timespec ts;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+            return 0;
+        }
+        return std::uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    // a sweep of one thread, several threads may sweep at the same time
+    struct sweep {
+        clock::time_point begin;
+        std::uint64_t nvml_time = 0;
+        // CPU time of the thread at its last end_sweep
+        std::uint64_t cpu_time = 0;
+    };
+
+    // api has to be a string literal, it is used by address. Calls outside of a sweep
+    // (e.g. of the slow lane) only count in the statistics of api.
+    void record_call(const char* api, std::uint64_t ns, sweep* in_sweep = nullptr)
+    {
+        calls[api].record(ns);
+        if (in_sweep != nullptr) {
+            in_sweep->nvml_time += ns;
+        }
+    }
+
+    static void begin_sweep(sweep& current)
+    {
+        current.nvml_time = 0;
+        current.begin = clock::now();
+    }
+
+    // records the sweep and appends a point to each overhead series, the CPU time of all
+    // sweeping threads adds up in one series
+    void end_sweep(sweep& current, system_time_point_t timestamp)
+    {
+        std::uint64_t cpu_time = thread_cpu_time();
+        total_cpu_time += cpu_time - std::min(cpu_time, current.cpu_time);
+        current.cpu_time = cpu_time;
+
+        std::uint64_t duration = since(current.begin);
+        sweeps.record(duration);
+
+        series["overhead_sweep_time"].emplace_back(timestamp, duration);
+        series["overhead_nvml_time"].emplace_back(timestamp, current.nvml_time);
+        series["overhead_cpu_time"].emplace_back(timestamp, total_cpu_time);
+    }
+
+    const std::vector<pair_chrono_value_t>& get_series(const std::string& metric_name)
+    {
+        return series[metric_name];
+    }
+
+    void log_summary()
+    {
+        logging::info() << "NVML plugin overhead: " << sweeps.count() << " sweeps, "
+                        << format(sweeps) << ", measurement CPU time " << total_cpu_time
+                        << " ns";
+        for (auto& call : calls) {
+            logging::info() << "NVML plugin overhead: " << call.first << " " << call.second.count()
+                            << " calls, " << format(call.second);
+        }
+    }
+
+private:
+    static std::string format(const latency_histogram& histogram)
+    {
+        if (histogram.count() == 0) {
+            return "no data";
+        }
+        return "mean " + std::to_string(histogram.sum() / histogram.count()) + " ns, min " +
+               std::to_string(histogram.min()) + " ns, p50 " +
+               std::to_string(histogram.percentile(50)) + " ns, p99 " +
+               std::to_string(histogram.percentile(99)) + " ns, max " +
+               std::to_string(histogram.max()) + " ns";
+    }
+
+    std::unordered_map<const char*, latency_histogram> calls;
+    latency_histogram sweeps;
+    std::uint64_t total_cpu_time = 0;
+
+    std::unordered_map<std::string, std::vector<pair_chrono_value_t>> series;
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_OVERHEAD_HPP
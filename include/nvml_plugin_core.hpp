@@ -0,0 +1,672 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_PLUGIN_CORE_HPP
+#define SCOREP_PLUGIN_NVML_NVML_PLUGIN_CORE_HPP
+
+#include "nvml_counter.hpp"
+#include "nvml_derived.hpp"
+#include "nvml_measurement_thread.hpp"
+#include "nvml_metrics_endpoint.hpp"
+#include "nvml_post_mortem.hpp"
+#include "nvml_runtime.hpp"
+#include "nvml_scorep_helper.hpp"
+#include "nvml_thread_placement.hpp"
+#include "nvml_time_convert.hpp"
+#include "nvml_topology.hpp"
+#include "nvml_types.hpp"
+#include "nvml_wrapper.hpp"
+
+#include <scorep/chrono/chrono.hpp>
+#include <scorep/plugin/plugin.hpp>
+
+#include <nvml.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace scorep::plugin::policy;
+
+using scorep::plugin::logging;
+
+/** Splits a requested metric like "power_usage:10ms" into name and interval.
+ *  The interval may be given in ms (default without unit) or s, it is 0 if not given.
+ */
+inline std::string split_metric_interval(const std::string& metric_name,
+                                         std::chrono::milliseconds& interval)
+{
+    interval = std::chrono::milliseconds(0);
+    std::size_t colon = metric_name.rfind(':');
+    if (colon == std::string::npos) {
+        return metric_name;
+    }
+
+    std::string value = metric_name.substr(colon + 1);
+    std::size_t unit_pos = value.find_first_not_of("0123456789");
+    std::string unit = unit_pos == std::string::npos ? "ms" : value.substr(unit_pos);
+    if (unit_pos == 0 || (unit != "ms" && unit != "s")) {
+        throw std::runtime_error("Invalid interval for metric " + metric_name +
+                                 ", expected e.g. :10ms or :1s");
+    }
+    interval = std::chrono::milliseconds(std::stoul(value.substr(0, unit_pos)));
+    if (unit == "s") {
+        interval *= 1000;
+    }
+    return metric_name.substr(0, colon);
+}
+
+/** Readers: which metric hierarchy a plugin uses and how the measurement thread reads it
+ */
+struct polled_reader {
+    using metric_type = Nvml_Metric;
+
+    static const char* default_interval()
+    {
+        return "50";
+    }
+
+    static const char* thread_name()
+    {
+        return "nvml-poll";
+    }
+
+    // TRIGGER is only evaluated while polling
+    static bool supports_triggers()
+    {
+        return true;
+    }
+
+    // metrics may have their own interval, e.g. "pcie_recv:200ms", or be derived from others,
+    // e.g. "sum(power_usage@*)"
+    static metric_type* create_metric(const std::string& metric_name,
+                                      const std::vector<nvmlDevice_t>& devices)
+    {
+        std::chrono::milliseconds interval;
+        std::string name = split_metric_interval(metric_name, interval);
+        metric_type* metric = is_derived_metric_name(name) ? new Derived_Metric(name, nvml_topology())
+                                                           : metric_name_2_nvml_function(name);
+        metric->set_interval(replay_scaled(interval));
+        return metric;
+    }
+
+    static bool per_device(const metric_type* metric)
+    {
+        return metric->is_per_device();
+    }
+
+    static void measure(nvml_measurement_thread<metric_type>& nvml_m)
+    {
+        nvml_m.measurement();
+    }
+};
+
+struct sampled_reader {
+    using metric_type = Nvml_Sampling_Metric;
+
+    static const char* default_interval()
+    {
+        return "5000";
+    }
+
+    static const char* thread_name()
+    {
+        return "nvml-sampling";
+    }
+
+    static bool supports_triggers()
+    {
+        return false;
+    }
+
+    static metric_type* create_metric(const std::string& metric_name,
+                                      const std::vector<nvmlDevice_t>& devices)
+    {
+        if (nvml_replayer() != nullptr) {
+            throw std::runtime_error("Only polled metrics can be replayed, not " + metric_name);
+        }
+        return metric_name_2_nvml_sampling_function(metric_name);
+    }
+
+    static bool per_device(const metric_type* metric)
+    {
+        return true;
+    }
+
+    static void measure(nvml_measurement_thread<metric_type>& nvml_m)
+    {
+        nvml_m.sampling_measurement();
+    }
+};
+
+struct event_reader {
+    using metric_type = Nvml_Event_Metric;
+
+    static const char* default_interval()
+    {
+        return "100";
+    }
+
+    static const char* thread_name()
+    {
+        return "nvml-event";
+    }
+
+    static bool supports_triggers()
+    {
+        return false;
+    }
+
+    static metric_type* create_metric(const std::string& metric_name,
+                                      const std::vector<nvmlDevice_t>& devices)
+    {
+        if (nvml_replayer() != nullptr) {
+            throw std::runtime_error("Only polled metrics can be replayed, not " + metric_name);
+        }
+        return metric_name_2_nvml_event_function(metric_name);
+    }
+
+    static bool per_device(const metric_type* metric)
+    {
+        return true;
+    }
+
+    static void measure(nvml_measurement_thread<metric_type>& nvml_m)
+    {
+        nvml_m.event_measurement();
+    }
+};
+
+/** Polls metrics on devices that do not keep samples of them and reads the sample buffer on
+ *  the GPU on the others, see Hybrid_Metric
+ */
+struct hybrid_reader {
+    using metric_type = Hybrid_Metric;
+
+    static const char* default_interval()
+    {
+        return "50";
+    }
+
+    static const char* thread_name()
+    {
+        return "nvml-hybrid";
+    }
+
+    static bool supports_triggers()
+    {
+        return false;
+    }
+
+    static metric_type* create_metric(const std::string& metric_name,
+                                      const std::vector<nvmlDevice_t>& devices)
+    {
+        Nvml_Metric* polled = polled_reader::create_metric(metric_name, devices);
+
+        // a replay only contains polled readings
+        Nvml_Sampling_Metric* sampled = nullptr;
+        const std::vector<std::string>& names = nvml_sampling_metric_names();
+        if (nvml_replayer() == nullptr &&
+            std::find(names.begin(), names.end(), polled->get_name()) != names.end()) {
+            sampled = metric_name_2_nvml_sampling_function(polled->get_name());
+        }
+        return new Hybrid_Metric(polled, sampled);
+    }
+
+    static bool per_device(metric_type* metric)
+    {
+        return metric->get_polled()->is_per_device();
+    }
+
+    static void measure(nvml_measurement_thread<metric_type>& nvml_m)
+    {
+        nvml_m.hybrid_measurement(std::chrono::milliseconds(
+            stoi(scorep::environment_variable::get("sampling_interval", "5000"))));
+    }
+};
+
+template <typename Reader>
+struct nvml_object_id {
+    template <typename T, typename Policies>
+    using type = scorep::plugin::policy::object_id<nvml_t<typename Reader::metric_type>, T, Policies>;
+};
+
+/** Delivery: asynchronous measurement thread, values are handed to Score-P post mortem
+ */
+template <typename Plugin, typename Reader>
+class async_post_mortem_delivery
+    : public scorep::plugin::base<Plugin, async, per_host, scorep_clock, post_mortem,
+                                  nvml_object_id<Reader>::template type> {
+    using handle_type = nvml_t<typename Reader::metric_type>;
+
+public:
+    async_post_mortem_delivery()
+        : nvml_m(replay_scaled(std::chrono::milliseconds(
+              stoi(scorep::environment_variable::get("interval", Reader::default_interval()))))),
+          placement(scorep::environment_variable::get("cpus", ""),
+                    scorep::environment_variable::get("priority", ""), Reader::thread_name())
+    {
+        nvml_m.set_sync_interval(std::chrono::milliseconds(
+            stoi(scorep::environment_variable::get("sync_interval", "10000"))));
+        nvml_m.set_timestamp_mode(
+            timestamp_mode_from_string(scorep::environment_variable::get("timestamp", "metric")));
+        nvml_m.set_aligned(scorep::environment_variable::get("align", "0") == "1");
+        numa = scorep::environment_variable::get("numa", "0") == "1";
+        nvml_m.set_suppress_inputs(scorep::environment_variable::get("suppress_inputs", "0") == "1");
+        if (scorep::environment_variable::get("overhead", "0") == "1") {
+            nvml_m.enable_overhead();
+        }
+        endpoint_address = scorep::environment_variable::get("endpoint", "");
+        if (!endpoint_address.empty()) {
+            nvml_m.enable_live_values();
+        }
+        std::string trigger = scorep::environment_variable::get("trigger", "");
+        if (!trigger.empty() && !Reader::supports_triggers()) {
+            logging::warn() << "Triggers are only supported by nvml_plugin, ignoring TRIGGER";
+        }
+        else if (!trigger.empty()) {
+            nvml_m.set_trigger(
+                parse_triggers(trigger),
+                std::chrono::milliseconds(stoi(scorep::environment_variable::get("trigger_pre", "100"))),
+                std::chrono::milliseconds(stoi(scorep::environment_variable::get("trigger_post", "100"))),
+                std::chrono::milliseconds(
+                    stoi(scorep::environment_variable::get("coarse_interval", "1000"))));
+        }
+        summary_path = scorep::environment_variable::get("summary", "");
+        if (!summary_path.empty()) {
+            nvml_m.enable_summary(
+                parse_summary_conditions(scorep::environment_variable::get("summary_conditions", "")),
+                scorep::environment_variable::get("summary_only", "0") != "1");
+        }
+        convert_threads = stoi(scorep::environment_variable::get(
+            "convert_threads", std::to_string(std::min(8u, std::thread::hardware_concurrency()))));
+    }
+
+    // start your measurement in this method
+    void start()
+    {
+        // e.g. no GPU on this node, nothing to measure
+        if (this->get_handles().empty()) {
+            logging::info() << "No NVML metrics to measure, measurement thread not started.";
+            return;
+        }
+
+        if (!endpoint_address.empty()) {
+            endpoint.reset(new metrics_endpoint(endpoint_address, nvml_m.get_live_values()));
+        }
+        // overhead metrics alone do not need NVML
+        auto& handles = this->get_handles();
+        if (numa && std::any_of(handles.begin(), handles.end(),
+                                [](const handle_type& handle) { return handle.metric != nullptr; })) {
+            nvml_m.set_device_affinity(nvml_topology(), placement.numa_scope());
+        }
+
+        nvml_thread = std::thread([this]() {
+            this->placement.apply();
+            // started from here, so the endpoint thread inherits the placement
+            if (this->endpoint) {
+                this->endpoint->start();
+            }
+            // an unexpected error ends the measurement, but not the application
+            try {
+                Reader::measure(this->nvml_m);
+            }
+            catch (std::exception& e) {
+                logging::error() << "NVML measurement stopped: " << e.what();
+            }
+        });
+
+        time_converter.synchronize_point(
+            nvml_m.get_timepoint(), scorep::chrono::measurement_clock::now());
+
+        logging::info() << "Successfully started NVML measurement.";
+    }
+
+    // stop your measurement in this method
+    void stop()
+    {
+        time_converter.synchronize_point(
+            nvml_m.get_timepoint(), scorep::chrono::measurement_clock::now());
+
+        nvml_m.stop_measurement();
+        if (nvml_thread.joinable()) {
+            nvml_thread.join();
+        }
+        if (endpoint) {
+            endpoint->stop();
+        }
+
+        for (auto& point : nvml_m.get_sync_points()) {
+            time_converter.synchronize_point(point.first, point.second);
+        }
+
+        nvml_m.log_overhead_summary();
+        if (!summary_path.empty()) {
+            write_summary();
+        }
+
+        conversion.start(this->get_handles(), convert_threads,
+                         [this](handle_type& handle) { return nvml_m.take_readings(handle); },
+                         time_converter);
+
+        logging::info() << "Successfully stopped NVML measurement.";
+    }
+
+    // Will be called post mortem by the measurement environment
+    // You return all values measured.
+    template <typename C>
+    void get_all_values(handle_type& handle, C& cursor)
+    {
+        logging::info() << "get_all_values called with: " << handle.name
+                        << " CUDA " << handle.device_idx;
+
+        // converted to ticks since stop()
+        auto values = conversion.take(handle);
+        bool as_double = handle.metric != nullptr && handle.metric->get_datatype() == DOUBLE;
+        for (auto& value : values) {
+            if (as_double) {
+                cursor.write(value.first, bits_to_double(value.second));
+            }
+            else {
+                cursor.write(value.first, value.second);
+            }
+        }
+
+        logging::debug() << "get_all_values wrote " << values.size() << " values (out of which "
+                         << cursor.size() << " are in the valid time range)";
+    }
+
+protected:
+    void add_overhead_metric(const std::string& metric_name)
+    {
+        this->make_handle(metric_name, handle_type{metric_name});
+    }
+
+    // {host} in the path is replaced by the host name, the plugin runs once per host
+    void write_summary()
+    {
+        char buffer[256] = {};
+        gethostname(buffer, sizeof(buffer) - 1);
+        std::string host = buffer;
+
+        std::string path = summary_path;
+        std::size_t pos = path.find("{host}");
+        if (pos != std::string::npos) {
+            path.replace(pos, 6, host);
+        }
+        nvml_m.write_summary(path, host);
+    }
+
+    void handles_changed()
+    {
+        // add all handles created yet
+        nvml_m.add_handles(this->get_handles());
+    }
+
+private:
+    piecewise_time_convert time_converter;
+
+    nvml_measurement_thread<typename Reader::metric_type> nvml_m;
+    thread_placement placement;
+    std::thread nvml_thread;
+
+    std::string endpoint_address;
+    std::unique_ptr<metrics_endpoint> endpoint;
+
+    std::string summary_path;
+    bool numa;
+
+    unsigned int convert_threads;
+    post_mortem_conversion<handle_type> conversion;
+};
+
+/** Delivery: values are read synchronously on Score-P events (e.g. ENTER and LEAVE)
+ */
+// policy::sync is qualified, it would be ambiguous with ::sync() from <unistd.h>
+template <typename Plugin, typename Reader>
+class sync_delivery
+    : public scorep::plugin::base<Plugin, scorep::plugin::policy::sync, per_host, scorep_clock,
+                                  nvml_object_id<Reader>::template type> {
+    using handle_type = nvml_t<typename Reader::metric_type>;
+
+public:
+    template <typename P>
+    bool get_optional_value(handle_type& handle, P& proxy)
+    {
+        logging::info() << "get_optional_value called with: " << handle.name
+                        << " CUDA " << handle.device_idx;
+
+        std::uint64_t data;
+        if (NVML_SUCCESS != handle.metric->read(handle.device, data)) {
+            return false;
+        }
+        // counters as rate since the previous read or total since the first one
+        unsigned int bits = handle.metric->get_counter_bits();
+        if (bits != 0 && !counters[handle].update(data, system_clock_t::now(), bits,
+                                                  handle.metric->get_counter_scale(),
+                                                  handle.metric->get_measure_type() == ABS, data)) {
+            return false;
+        }
+        if (handle.metric->get_datatype() == DOUBLE) {
+            proxy.write(bits_to_double(data));
+        }
+        else {
+            proxy.write(data);
+        }
+        return true;
+    }
+
+protected:
+    void add_overhead_metric(const std::string& metric_name)
+    {
+        throw std::runtime_error("Metric " + metric_name +
+                                 " is only available in asynchronous plugins");
+    }
+
+    void handles_changed()
+    {
+    }
+
+private:
+    std::unordered_map<std::reference_wrapper<handle_type>, counter_state, std::hash<handle_type>,
+                       std::equal_to<handle_type>>
+        counters;
+};
+
+/** Keeps NVML initialized for the lifetime of a plugin. All plugins of a process share one
+ *  nvml_runtime: the first one initializes NVML, the last one shuts it down.
+ *  Without NVML library or driver (e.g. on nodes without GPU) the plugin stays loaded but
+ *  provides no metrics instead of aborting the measurement.
+ */
+class nvml_session {
+public:
+    nvml_session()
+    {
+        nvml_runtime& runtime = nvml_runtime::instance();
+        std::lock_guard<std::mutex> lock(runtime.mutex);
+        if (runtime.users == 0) {
+            runtime.initialized = init_nvml();
+        }
+        ++runtime.users;
+        available = runtime.initialized;
+    }
+
+    ~nvml_session()
+    {
+        // samples of this plugin, NVML may be shut down below
+        release_gpm_samplers();
+
+        nvml_runtime& runtime = nvml_runtime::instance();
+        std::lock_guard<std::mutex> lock(runtime.mutex);
+        if (--runtime.users > 0 || !runtime.initialized) {
+            return;
+        }
+        // device handles are invalid afterwards
+        runtime.initialized = false;
+        runtime.topology_built = false;
+        runtime.devices.clear();
+        if (nvml_replayer() != nullptr) {
+            return;
+        }
+
+        nvmlReturn_t nvml = nvml_lib().nvmlShutdown();
+        if (NVML_SUCCESS != nvml) {
+            logging::warn() << "Could not terminate NVML. Code:"
+                            << std::string(nvml_lib().nvmlErrorString(nvml));
+        }
+    }
+
+    nvml_session(const nvml_session&) = delete;
+    nvml_session& operator=(const nvml_session&) = delete;
+
+protected:
+    bool nvml_available() const
+    {
+        return available;
+    }
+
+private:
+    // initializes NVML for the first plugin of the process, false if it is not usable
+    static bool init_nvml()
+    {
+        // a replay needs neither the library nor a GPU
+        if (nvml_replayer() != nullptr) {
+            logging::info() << "Replaying recorded NVML readings of "
+                            << nvml_replayer()->device_count() << " devices";
+            return true;
+        }
+
+        if (!nvml_lib().available()) {
+            logging::info() << "NVML library not found, no NVML metrics will be recorded: "
+                            << nvml_lib().get_error();
+            return false;
+        }
+
+        nvmlReturn_t nvml = nvml_lib().nvmlInit_v2();
+        if (NVML_ERROR_DRIVER_NOT_LOADED == nvml || NVML_ERROR_LIBRARY_NOT_FOUND == nvml) {
+            logging::info() << "NVML driver not loaded, no NVML metrics will be recorded: "
+                            << nvml_lib().nvmlErrorString(nvml);
+            return false;
+        }
+        if (NVML_SUCCESS != nvml) {
+            throw std::runtime_error("Could not start NVML. Code: " +
+                                     std::string(nvml_lib().nvmlErrorString(nvml)));
+        }
+        return true;
+    }
+
+    bool available = false;
+};
+
+// handles of the devices visible to the process, see nvml_topology
+inline std::vector<nvmlDevice_t> get_visible_devices()
+{
+    std::vector<nvmlDevice_t> devices;
+    for (auto& info : nvml_topology()) {
+        devices.push_back(info.device);
+    }
+    return devices;
+}
+
+/** Common part of all NVML plugins, parameterised on how metrics are read (Reader)
+ *  and how values reach Score-P (Delivery).
+ *  NVML is initialized before and shut down after everything in Delivery.
+ */
+template <typename Plugin, typename Reader, template <typename, typename> class Delivery>
+class nvml_plugin_core : private nvml_session, public Delivery<Plugin, Reader> {
+public:
+    using metric_type = typename Reader::metric_type;
+    using handle_type = nvml_t<metric_type>;
+
+    // Convert a named metric (may contain wildcards or so) to a vector of
+    // actual metrics (may have a different name)
+    std::vector<scorep::plugin::metric_property> get_metric_properties(const std::string& metric_name)
+    {
+        std::vector<scorep::plugin::metric_property> properties;
+
+        logging::info() << "get_metric_properties() called with: " << metric_name;
+
+        if (is_overhead_metric(metric_name)) {
+            this->add_overhead_metric(metric_name);
+            this->handles_changed();
+            properties.push_back(overhead_metric_property(metric_name));
+            return properties;
+        }
+
+        if (!this->nvml_available()) {
+            return properties;
+        }
+
+        std::vector<nvmlDevice_t> nvml_devices = get_visible_devices();
+        if (nvml_devices.empty()) {
+            return properties;
+        }
+
+        metric_type* metric = Reader::create_metric(metric_name, nvml_devices);
+
+        // metrics for the whole node get one handle, read on the first device
+        bool per_device = Reader::per_device(metric);
+        bool used = false;
+        for (unsigned int i = 0; i < (per_device ? nvml_devices.size() : 1); ++i) {
+            // NVML index, differs from i if devices before lack permission
+            unsigned int device_idx = nvml_topology()[i].index;
+
+            // drop unsupported combinations here, so the measurement never sees them
+            nvmlReturn_t ret = metric->probe(nvml_devices[i]);
+            if (NVML_SUCCESS != ret) {
+                logging::warn() << "Metric " << metric_name << " is not available on CUDA: " << device_idx
+                                << ", it will not be recorded there. Code: "
+                                << nvml_lib().nvmlErrorString(ret);
+                continue;
+            }
+
+            // an interval of its own stays in the name as requested, e.g. "power_usage:10ms", so
+            // the same metric with different intervals can be told apart in the trace
+            std::string new_name = metric->get_name();
+            if (metric_interval(metric).count() > 0) {
+                new_name += metric_name.substr(metric_name.rfind(':'));
+            }
+            if (per_device) {
+                new_name += " on CUDA: " + std::to_string(device_idx);
+            }
+            this->make_handle(new_name, handle_type{metric->get_name(), nvml_devices[i], metric});
+            used = true;
+
+            scorep::plugin::metric_property property = scorep::plugin::metric_property(
+                new_name, metric->get_desc(), metric->get_unit());
+
+            if (!set_scorep_datatype(metric, property)) {
+                throw std::runtime_error("Unknown datatype for metric " + metric_name);
+            }
+
+            if (!set_scorep_measure_type(metric, property)) {
+                throw std::runtime_error("Unknown measure type for metric " + metric_name);
+            }
+
+            properties.push_back(property);
+        }
+
+        // no handle refers to a metric that no device supports
+        if (!used) {
+            delete metric;
+            return properties;
+        }
+
+        this->handles_changed();
+
+        return properties;
+    }
+
+    void add_metric(handle_type& handle)
+    {
+        logging::info() << "add metric called with: " << handle.name
+                        << " on CUDA " << handle.device_idx;
+    }
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_PLUGIN_CORE_HPP
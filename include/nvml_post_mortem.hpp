@@ -0,0 +1,128 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_POST_MORTEM_HPP
+#define SCOREP_PLUGIN_NVML_NVML_POST_MORTEM_HPP
+
+#include "nvml_time_convert.hpp"
+#include "nvml_types.hpp"
+
+#include <scorep/chrono/chrono.hpp>
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/** Converts the series of all handles to Score-P ticks on a few worker threads as soon as the
+ *  measurement has stopped, in the order of the handles, which is the order Score-P asks for
+ *  them. get_all_values then only waits for its handle and writes the prepared buffer.
+ */
+template <typename Handle>
+class post_mortem_conversion {
+public:
+    using series_t = std::vector<std::pair<scorep::chrono::ticks, std::uint64_t>>;
+    // moves the raw series of a handle out of the measurement
+    using fetch_t = std::function<std::vector<pair_chrono_value_t>(Handle&)>;
+
+    ~post_mortem_conversion()
+    {
+        join();
+    }
+
+    // converter must not get further synchronization points until all series are taken
+    template <typename Handles>
+    void start(Handles& handles,
+               unsigned int threads,
+               fetch_t fetch_,
+               piecewise_time_convert& converter_)
+    {
+        fetch = fetch_;
+        converter = &converter_;
+        // builds the segments, so the workers only read the converter
+        converter->prepare();
+
+        series.clear();
+        series.resize(handles.size());
+        index.clear();
+        for (std::size_t i = 0; i < handles.size(); ++i) {
+            index.emplace(handles[i], i);
+            series[i].handle = &handles[i];
+        }
+
+        next = 0;
+        threads = std::max(1u, std::min<unsigned int>(threads, handles.size()));
+        for (unsigned int i = 0; i < threads; ++i) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    // waits until the series of handle (or an equal copy of it) is converted, it can be taken once
+    series_t take(const Handle& handle)
+    {
+        auto it = index.find(handle);
+        if (it == index.end()) {
+            return series_t();
+        }
+        prepared& entry = series[it->second];
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&entry]() { return entry.ready; });
+        series_t result;
+        result.swap(entry.points);
+        return result;
+    }
+
+    void join()
+    {
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+private:
+    struct prepared {
+        Handle* handle = nullptr;
+        series_t points;
+        bool ready = false;
+    };
+
+    void work()
+    {
+        pthread_setname_np(pthread_self(), "nvml-convert");
+
+        for (std::size_t i = next++; i < series.size(); i = next++) {
+            auto values = fetch(*series[i].handle);
+            series_t points;
+            points.reserve(values.size());
+            for (auto& value : values) {
+                points.emplace_back(converter->to_ticks(value.first), value.second);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            series[i].points.swap(points);
+            series[i].ready = true;
+            done.notify_all();
+        }
+    }
+
+    fetch_t fetch;
+    piecewise_time_convert* converter = nullptr;
+
+    std::vector<prepared> series;
+    // by value, Score-P may pass a copy of the handle
+    std::unordered_map<Handle, std::size_t> index;
+
+    std::atomic<std::size_t> next{ 0 };
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_POST_MORTEM_HPP
@@ -0,0 +1,253 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_RECORD_HPP
+#define SCOREP_PLUGIN_NVML_NVML_RECORD_HPP
+
+#include <nvml.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/** File with the raw results of metric reads, written with SCOREP_METRIC_NVML_RECORD and
+ *  read back with SCOREP_METRIC_NVML_REPLAY. Binary, host byte order:
+ *    "NVMLREC1"
+ *    'D' u32 device_count
+ *    'S' u16 stream, u16 length, name      a stream is one metric on one device,
+ *        u32 device                        defined before its first reading
+ *    'R' u16 stream, u64 start_ns, u32 duration_ns, i32 result, u64 value
+ *  start_ns is the time of the call relative to the first record.
+ */
+namespace record_format {
+static const char magic[8] = { 'N', 'V', 'M', 'L', 'R', 'E', 'C', '1' };
+}
+
+// one read of a metric as recorded
+struct recorded_reading {
+    std::uint64_t start_ns;
+    std::uint32_t duration_ns;
+    nvmlReturn_t result;
+    std::uint64_t value;
+};
+
+class reading_recorder {
+public:
+    explicit reading_recorder(const std::string& path)
+    {
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            throw std::runtime_error("Could not open " + path + " to record NVML readings: " +
+                                     std::strerror(errno));
+        }
+        std::fwrite(record_format::magic, sizeof(record_format::magic), 1, file);
+        begin = std::chrono::steady_clock::now();
+    }
+
+    ~reading_recorder()
+    {
+        std::fclose(file);
+    }
+
+    reading_recorder(const reading_recorder&) = delete;
+    reading_recorder& operator=(const reading_recorder&) = delete;
+
+    void device_count(std::uint32_t count)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        put('D');
+        put(count);
+    }
+
+    // called by the measurement threads of all plugins, so it is serialised
+    void reading(const std::string& metric_name,
+                 std::uint32_t device,
+                 std::chrono::steady_clock::time_point start,
+                 std::uint32_t duration_ns,
+                 nvmlReturn_t result,
+                 std::uint64_t value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto key = std::make_pair(metric_name, device);
+        auto it = streams.find(key);
+        if (it == streams.end()) {
+            it = streams.emplace(key, static_cast<std::uint16_t>(streams.size())).first;
+            put('S');
+            put(it->second);
+            put(static_cast<std::uint16_t>(metric_name.size()));
+            std::fwrite(metric_name.data(), metric_name.size(), 1, file);
+            put(device);
+        }
+
+        put('R');
+        put(it->second);
+        put(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(start - begin).count()));
+        put(duration_ns);
+        put(static_cast<std::int32_t>(result));
+        put(value);
+    }
+
+private:
+    template <typename V>
+    void put(V value)
+    {
+        std::fwrite(&value, sizeof(value), 1, file);
+    }
+
+    std::FILE* file;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point begin;
+    std::map<std::pair<std::string, std::uint32_t>, std::uint16_t> streams;
+};
+
+/** Hands out the readings of a recording in their original order per metric and device.
+ *  With speed > 0 a read waits until its recorded start (relative to the first replayed read,
+ *  divided by speed) and then for its recorded duration divided by speed, i.e. 1 replays in
+ *  real time, 10 ten times faster. 0 replays without waiting.
+ */
+class reading_replayer {
+public:
+    reading_replayer(const std::string& path, double speed_)
+        : speed(speed_)
+    {
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            throw std::runtime_error("Could not open NVML recording " + path + ": " +
+                                     std::strerror(errno));
+        }
+
+        char magic[sizeof(record_format::magic)];
+        if (std::fread(magic, sizeof(magic), 1, file) != 1 ||
+            std::memcmp(magic, record_format::magic, sizeof(magic)) != 0) {
+            std::fclose(file);
+            throw std::runtime_error(path + " is no NVML recording");
+        }
+
+        std::vector<std::pair<std::string, std::uint32_t>> stream_keys;
+        int type;
+        bool complete = true;
+        while ((type = std::fgetc(file)) != EOF && complete) {
+            if (type == 'D') {
+                complete = get(file, devices);
+            }
+            else if (type == 'S') {
+                std::uint16_t id, length;
+                std::uint32_t device;
+                complete = get(file, id) && get(file, length);
+                std::string name(length, '\0');
+                complete = complete && (length == 0 || std::fread(&name[0], length, 1, file) == 1) &&
+                           get(file, device);
+                if (complete) {
+                    stream_keys.resize(std::max<std::size_t>(stream_keys.size(), id + 1));
+                    stream_keys[id] = std::make_pair(name, device);
+                }
+            }
+            else if (type == 'R') {
+                std::uint16_t id;
+                std::int32_t result;
+                recorded_reading reading;
+                complete = get(file, id) && get(file, reading.start_ns) &&
+                           get(file, reading.duration_ns) && get(file, result) &&
+                           get(file, reading.value);
+                if (complete && id < stream_keys.size()) {
+                    reading.result = static_cast<nvmlReturn_t>(result);
+                    streams[stream_keys[id]].readings.push_back(reading);
+                }
+            }
+            else {
+                std::fclose(file);
+                throw std::runtime_error(path + " is corrupt, unknown record type " +
+                                         std::to_string(type));
+            }
+        }
+        // a recording cut off by a crash is used up to its last complete record
+        std::fclose(file);
+    }
+
+    reading_replayer(const reading_replayer&) = delete;
+    reading_replayer& operator=(const reading_replayer&) = delete;
+
+    std::uint32_t device_count() const
+    {
+        return devices;
+    }
+
+    double get_speed() const
+    {
+        return speed;
+    }
+
+    // the next reading of metric_name on device, NVML_ERROR_NOT_FOUND after the last one
+    nvmlReturn_t next(const std::string& metric_name, std::uint32_t device, std::uint64_t& value)
+    {
+        recorded_reading reading;
+        std::chrono::steady_clock::time_point begin;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = streams.find(std::make_pair(metric_name, device));
+            if (it == streams.end() || it->second.next == it->second.readings.size()) {
+                return NVML_ERROR_NOT_FOUND;
+            }
+            reading = it->second.readings[it->second.next++];
+
+            if (!started) {
+                started = true;
+                first_start_ns = reading.start_ns;
+                replay_begin = std::chrono::steady_clock::now();
+            }
+            begin = replay_begin;
+        }
+
+        if (speed > 0) {
+            std::this_thread::sleep_until(
+                begin + std::chrono::nanoseconds(static_cast<std::uint64_t>(
+                            (reading.start_ns - std::min(reading.start_ns, first_start_ns)) / speed)));
+            std::this_thread::sleep_for(std::chrono::nanoseconds(
+                static_cast<std::uint64_t>(reading.duration_ns / speed)));
+        }
+        value = reading.value;
+        return reading.result;
+    }
+
+private:
+    template <typename V>
+    static bool get(std::FILE* file, V& value)
+    {
+        return std::fread(&value, sizeof(value), 1, file) == 1;
+    }
+
+    struct stream {
+        std::vector<recorded_reading> readings;
+        std::size_t next = 0;
+    };
+
+    double speed;
+    std::uint32_t devices = 0;
+    std::map<std::pair<std::string, std::uint32_t>, stream> streams;
+
+    std::mutex mutex;
+    bool started = false;
+    std::uint64_t first_start_ns = 0;
+    std::chrono::steady_clock::time_point replay_begin;
+};
+
+// devices of a replay are represented by these handles, they are never passed to NVML
+inline nvmlDevice_t replay_device(std::uint32_t index)
+{
+    return reinterpret_cast<nvmlDevice_t>(static_cast<std::uintptr_t>(index) + 1);
+}
+
+inline std::uint32_t replay_device_index(nvmlDevice_t device)
+{
+    return static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(device) - 1);
+}
+
+#endif // SCOREP_PLUGIN_NVML_NVML_RECORD_HPP
@@ -0,0 +1,99 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_RUNTIME_HPP
+#define SCOREP_PLUGIN_NVML_NVML_RUNTIME_HPP
+
+#include "nvml_record.hpp"
+
+#include <nvml.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// a device visible to the process
+struct nvml_device_info {
+    nvmlDevice_t device;
+    unsigned int index;
+    std::string name;
+    std::string uuid;
+    std::string pci_bus_id;
+    // CPUs and NUMA node close to the device, empty and -1 if unknown
+    std::vector<int> cpus;
+    int numa_node = -1;
+};
+
+/** NVML state shared by all plugins loaded into one process. Every plugin is a module of its
+ *  own, so the instance lives in libnvml_runtime.so, which the dynamic linker loads only once.
+ *  Members are guarded by mutex unless noted otherwise.
+ */
+struct nvml_runtime {
+    // defined in src/nvml_runtime.cpp
+    static nvml_runtime& instance();
+
+    std::mutex mutex;
+
+    // plugins using NVML, it is shut down when the last one is done
+    unsigned int users = 0;
+    bool initialized = false;
+
+    // see nvml_topology(), invalid after NVML is shut down
+    bool topology_built = false;
+    std::vector<nvml_device_info> devices;
+
+    // created once on first use, see nvml_recorder() and nvml_replayer()
+    std::once_flag record_once;
+    std::unique_ptr<reading_recorder> recorder;
+    std::once_flag replay_once;
+    std::unique_ptr<reading_replayer> replayer;
+};
+
+/** The recorder if SCOREP_METRIC_NVML_RECORD is set, nullptr otherwise. Shared by all
+ *  plugins of the process.
+ */
+inline reading_recorder* nvml_recorder()
+{
+    nvml_runtime& runtime = nvml_runtime::instance();
+    std::call_once(runtime.record_once, [&runtime]() {
+        const char* path = std::getenv("SCOREP_METRIC_NVML_RECORD");
+        if (path != nullptr && *path != '\0' && std::getenv("SCOREP_METRIC_NVML_REPLAY") == nullptr) {
+            runtime.recorder.reset(new reading_recorder(path));
+        }
+    });
+    return runtime.recorder.get();
+}
+
+/** The replayer if SCOREP_METRIC_NVML_REPLAY is set, nullptr otherwise. The speed is taken
+ *  from SCOREP_METRIC_NVML_REPLAY_SPEED (default 1).
+ */
+inline reading_replayer* nvml_replayer()
+{
+    nvml_runtime& runtime = nvml_runtime::instance();
+    std::call_once(runtime.replay_once, [&runtime]() {
+        const char* path = std::getenv("SCOREP_METRIC_NVML_REPLAY");
+        if (path != nullptr && *path != '\0') {
+            const char* speed = std::getenv("SCOREP_METRIC_NVML_REPLAY_SPEED");
+            runtime.replayer.reset(
+                new reading_replayer(path, speed != nullptr ? std::atof(speed) : 1.0));
+        }
+    });
+    return runtime.replayer.get();
+}
+
+/** Polling interval divided by the replay speed, so the measurement is scheduled as fast as
+ *  the recorded reads are replayed. Unchanged without replay or with speed 0, at least 1ms.
+ */
+inline std::chrono::milliseconds replay_scaled(std::chrono::milliseconds interval)
+{
+    reading_replayer* replayer = nvml_replayer();
+    if (replayer == nullptr || replayer->get_speed() <= 0 || interval.count() == 0) {
+        return interval;
+    }
+    return std::max(std::chrono::milliseconds(1),
+                    std::chrono::milliseconds(static_cast<std::chrono::milliseconds::rep>(
+                        interval.count() / replayer->get_speed())));
+}
+
+#endif // SCOREP_PLUGIN_NVML_NVML_RUNTIME_HPP
@@ -0,0 +1,355 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_SUMMARY_HPP
+#define SCOREP_PLUGIN_NVML_NVML_SUMMARY_HPP
+
+#include "nvml_trigger.hpp"
+#include "nvml_types.hpp"
+#include "nvml_wrapper.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// JSON string, names of derived metrics may contain anything
+inline std::string json_string(const std::string& text)
+{
+    std::string result = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        if (static_cast<unsigned char>(c) < 0x20) {
+            continue;
+        }
+        result += c;
+    }
+    return result + "\"";
+}
+
+/** Quantiles of a stream of values with 1% relative error (DDSketch). Values are counted in
+ *  buckets growing geometrically by gamma = 1.01 / 0.99, positive and negative values apart.
+ *  At most max_buckets per sign are kept, beyond that the smallest magnitudes are collapsed,
+ *  so memory is constant and the upper quantiles stay accurate. Sketches merge exactly.
+ */
+class quantile_sketch {
+public:
+    void add(double value)
+    {
+        if (value > min_indexable) {
+            positive.add(key(value), 1);
+        }
+        else if (value < -min_indexable) {
+            negative.add(key(-value), 1);
+        }
+        else {
+            ++zeros;
+        }
+        ++n;
+    }
+
+    void merge(const quantile_sketch& other)
+    {
+        positive.merge(other.positive);
+        negative.merge(other.negative);
+        zeros += other.zeros;
+        n += other.n;
+    }
+
+    std::uint64_t count() const
+    {
+        return n;
+    }
+
+    // q in [0, 1], NaN without values
+    double quantile(double q) const
+    {
+        if (n == 0) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        double rank = q * (n - 1);
+        std::uint64_t seen = 0;
+        for (std::size_t i = negative.counts.size(); i-- > 0;) {
+            seen += negative.counts[i];
+            if (seen > rank) {
+                return -value(negative.offset + static_cast<int>(i));
+            }
+        }
+        seen += zeros;
+        if (seen > rank) {
+            return 0;
+        }
+        for (std::size_t i = 0; i < positive.counts.size(); ++i) {
+            seen += positive.counts[i];
+            if (seen > rank) {
+                return value(positive.offset + static_cast<int>(i));
+            }
+        }
+        return value(positive.offset + static_cast<int>(positive.counts.size()) - 1);
+    }
+
+private:
+    static constexpr double min_indexable = 1e-9;
+
+    // log of gamma = (1 + 0.01) / (1 - 0.01)
+    static double log_gamma()
+    {
+        return std::log(1.01 / 0.99);
+    }
+
+    static int key(double magnitude)
+    {
+        return static_cast<int>(std::ceil(std::log(magnitude) / log_gamma()));
+    }
+
+    // middle of the bucket in terms of relative error
+    static double value(int key)
+    {
+        double gamma = 1.01 / 0.99;
+        return 2 * std::exp(key * log_gamma()) / (gamma + 1);
+    }
+
+    // counts of consecutive keys starting at offset
+    struct store {
+        enum : int { max_buckets = 2048 };
+
+        int offset = 0;
+        std::vector<std::uint64_t> counts;
+
+        void add(int key, std::uint64_t count)
+        {
+            if (counts.empty()) {
+                offset = key;
+                counts.push_back(0);
+            }
+            int last = offset + static_cast<int>(counts.size()) - 1;
+            if (key < offset || key > last) {
+                resize(std::min(key, offset), std::max(key, last));
+            }
+            counts[std::max(key, offset) - offset] += count;
+        }
+
+        void merge(const store& other)
+        {
+            for (std::size_t i = 0; i < other.counts.size(); ++i) {
+                if (other.counts[i] != 0) {
+                    add(other.offset + static_cast<int>(i), other.counts[i]);
+                }
+            }
+        }
+
+        // keys below the range of max_buckets ending at last go to the lowest bucket
+        void resize(int first, int last)
+        {
+            if (last - first + 1 > max_buckets) {
+                first = last - max_buckets + 1;
+            }
+            std::vector<std::uint64_t> resized(last - first + 1, 0);
+            for (std::size_t i = 0; i < counts.size(); ++i) {
+                resized[std::max(offset + static_cast<int>(i), first) - first] += counts[i];
+            }
+            counts.swap(resized);
+            offset = first;
+        }
+    };
+
+    store positive;
+    store negative;
+    std::uint64_t zeros = 0;
+    std::uint64_t n = 0;
+};
+
+/** Summary of all values of one handle in constant memory: moments, quantiles and the time
+ *  during which threshold conditions held (time between a point meeting the condition and the
+ *  next point). Summaries of several handles merge, e.g. for all devices of a node.
+ */
+class value_summary {
+public:
+    explicit value_summary(metric_datatype datatype_) : datatype(datatype_)
+    {
+    }
+
+    // only > and < conditions, see parse_triggers
+    void add_condition(const trigger_condition& condition)
+    {
+        conditions.push_back(condition_time{ condition });
+    }
+
+    // value as recorded, i.e. the bit pattern of a double for double metrics
+    void add(system_time_point_t timestamp, std::uint64_t recorded)
+    {
+        double value = to_double(recorded);
+        if (std::isnan(value)) {
+            return;
+        }
+
+        for (auto& condition : conditions) {
+            if (has_previous && condition.held) {
+                condition.seconds +=
+                    std::chrono::duration<double>(timestamp - previous_time).count();
+            }
+            condition.held = condition.condition.fires(value);
+        }
+        has_previous = true;
+        previous_time = timestamp;
+
+        if (n == 0) {
+            first = value;
+            minimum = value;
+            maximum = value;
+        }
+        last = value;
+        minimum = std::min(minimum, value);
+        maximum = std::max(maximum, value);
+
+        // Welford
+        ++n;
+        double delta = value - mean;
+        mean += delta / n;
+        m2 += delta * (value - mean);
+
+        sketch.add(value);
+    }
+
+    // the series has a gap (e.g. the device was lost), it does not count for the conditions
+    void interrupt()
+    {
+        has_previous = false;
+    }
+
+    void merge(const value_summary& other)
+    {
+        if (other.n == 0) {
+            return;
+        }
+        if (n == 0) {
+            minimum = other.minimum;
+            maximum = other.maximum;
+        }
+        minimum = std::min(minimum, other.minimum);
+        maximum = std::max(maximum, other.maximum);
+
+        // Chan et al.
+        std::uint64_t total = n + other.n;
+        double delta = other.mean - mean;
+        mean += delta * other.n / total;
+        m2 += other.m2 + delta * delta * n * other.n / total;
+        n = total;
+
+        sketch.merge(other.sketch);
+        for (std::size_t i = 0; i < conditions.size() && i < other.conditions.size(); ++i) {
+            conditions[i].seconds += other.conditions[i].seconds;
+        }
+        // first and last of a merged summary are meaningless
+        merged = true;
+    }
+
+    std::uint64_t count() const
+    {
+        return n;
+    }
+
+    // the fields of a JSON object, without braces
+    void write_json(std::ostream& out) const
+    {
+        out << "\"count\": " << n;
+        write_number(out, "mean", n == 0 ? NAN : mean);
+        write_number(out, "stddev", n < 2 ? NAN : std::sqrt(m2 / (n - 1)));
+        write_number(out, "min", n == 0 ? NAN : minimum);
+        write_number(out, "max", n == 0 ? NAN : maximum);
+        if (!merged) {
+            write_number(out, "first", n == 0 ? NAN : first);
+            write_number(out, "last", n == 0 ? NAN : last);
+        }
+        // clamped, a bucket may reach beyond the values seen
+        write_number(out, "p50", clamp(sketch.quantile(0.5)));
+        write_number(out, "p95", clamp(sketch.quantile(0.95)));
+        write_number(out, "p99", clamp(sketch.quantile(0.99)));
+        if (conditions.empty()) {
+            return;
+        }
+        out << ", \"seconds\": {";
+        for (std::size_t i = 0; i < conditions.size(); ++i) {
+            auto& condition = conditions[i].condition;
+            std::ostringstream key;
+            key.precision(out.precision());
+            key << condition.metric << condition.op << condition.threshold;
+            out << (i == 0 ? "" : ", ") << json_string(key.str()) << ": " << conditions[i].seconds;
+        }
+        out << "}";
+    }
+
+private:
+    struct condition_time {
+        trigger_condition condition;
+        bool held = false;
+        double seconds = 0;
+    };
+
+    double to_double(std::uint64_t recorded) const
+    {
+        switch (datatype) {
+        case DOUBLE:
+            return bits_to_double(recorded);
+        case INT:
+            return static_cast<double>(static_cast<std::int64_t>(recorded));
+        default:
+            return static_cast<double>(recorded);
+        }
+    }
+
+    double clamp(double value) const
+    {
+        return std::isnan(value) ? value : std::max(minimum, std::min(maximum, value));
+    }
+
+    // NaN is not valid JSON
+    static void write_number(std::ostream& out, const char* name, double value)
+    {
+        out << ", \"" << name << "\": ";
+        if (std::isfinite(value)) {
+            out << value;
+        }
+        else {
+            out << "null";
+        }
+    }
+
+    metric_datatype datatype;
+
+    std::uint64_t n = 0;
+    double mean = 0;
+    double m2 = 0;
+    double minimum = 0;
+    double maximum = 0;
+    double first = 0;
+    double last = 0;
+    bool merged = false;
+
+    quantile_sketch sketch;
+
+    std::vector<condition_time> conditions;
+    bool has_previous = false;
+    system_time_point_t previous_time;
+};
+
+// conditions like the trigger conditions, but changes (metric~) have no duration
+inline std::vector<trigger_condition> parse_summary_conditions(const std::string& text)
+{
+    std::vector<trigger_condition> conditions = parse_triggers(text);
+    for (auto& condition : conditions) {
+        if (condition.op == '~') {
+            throw std::runtime_error("Invalid summary condition " + condition.metric +
+                                     "~, expected <metric>>N or <metric><N");
+        }
+    }
+    return conditions;
+}
+
+#endif // SCOREP_PLUGIN_NVML_NVML_SUMMARY_HPP
@@ -0,0 +1,261 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_THREAD_PLACEMENT_HPP
+#define SCOREP_PLUGIN_NVML_NVML_THREAD_PLACEMENT_HPP
+
+#include <scorep/plugin/plugin.hpp>
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using scorep::plugin::logging;
+
+/** Parses a Linux CPU list like "0,2-4,7" as used in sysfs and cpusets
+ */
+inline std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.find_first_not_of(" \t\n") == std::string::npos) {
+            continue;
+        }
+        std::size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+inline std::vector<int> read_sysfs_cpu_list(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string list;
+    if (!file || !std::getline(file, list)) {
+        return {};
+    }
+    return parse_cpu_list(list);
+}
+
+// CPUs the process may run on: Cpus_allowed_list of /proc/self/status (the cpuset of its
+// cgroup), empty if unknown
+inline std::vector<int> read_allowed_cpus()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 18, "Cpus_allowed_list:") == 0) {
+            return parse_cpu_list(line.substr(18));
+        }
+    }
+    return {};
+}
+
+/** One housekeeping CPU for the measurement thread: an online CPU the process is allowed to
+ *  run on (anything else fails with EINVAL and may belong to other processes, e.g. other MPI
+ *  ranks of a per host plugin), preferably neither isolated nor nohz_full. The highest one is
+ *  taken, as applications usually fill CPUs from the lowest. Empty if nothing was found.
+ */
+inline std::vector<int> detect_housekeeping_cpus()
+{
+    std::vector<int> online = read_sysfs_cpu_list("/sys/devices/system/cpu/online");
+    std::vector<int> isolated = read_sysfs_cpu_list("/sys/devices/system/cpu/isolated");
+    std::vector<int> nohz_full = read_sysfs_cpu_list("/sys/devices/system/cpu/nohz_full");
+    std::vector<int> allowed = read_allowed_cpus();
+
+    auto contains = [](const std::vector<int>& cpus, int cpu) {
+        return std::find(cpus.begin(), cpus.end(), cpu) != cpus.end();
+    };
+
+    cpu_set_t process_mask;
+    CPU_ZERO(&process_mask);
+    bool have_mask = sched_getaffinity(0, sizeof(process_mask), &process_mask) == 0;
+
+    std::vector<int> housekeeping;
+    std::vector<int> inside;
+    for (int cpu : online) {
+        if ((have_mask && (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &process_mask))) ||
+            (!allowed.empty() && !contains(allowed, cpu))) {
+            continue;
+        }
+        inside.push_back(cpu);
+        if (!contains(isolated, cpu) && !contains(nohz_full, cpu)) {
+            housekeeping.push_back(cpu);
+        }
+    }
+
+    if (!housekeeping.empty()) {
+        return { housekeeping.back() };
+    }
+    if (!inside.empty()) {
+        return { inside.back() };
+    }
+    return {};
+}
+
+/** Where and with which priority the measurement thread runs.
+ *  cpus:     "" (OS decides), "auto" (housekeeping CPU) or a CPU list like "0,2-3"
+ *  priority: "" (unchanged), "fifo:<1-99>" (SCHED_FIFO, needs CAP_SYS_NICE) or "nice:<-20-19>"
+ *  Failing to apply any of it only results in a warning.
+ */
+class thread_placement {
+public:
+    thread_placement(const std::string& cpus_, const std::string& priority_, const std::string& name_)
+        : name(name_)
+    {
+        if (cpus_ == "auto") {
+            automatic = true;
+            cpus = detect_housekeeping_cpus();
+            if (cpus.empty()) {
+                logging::warn() << "Could not detect a housekeeping CPU, measurement thread is not pinned.";
+            }
+        }
+        else {
+            cpus = parse_cpu_list(cpus_);
+        }
+
+        if (!priority_.empty()) {
+            std::size_t colon = priority_.find(':');
+            if (colon == std::string::npos) {
+                throw std::runtime_error("Invalid priority, expected fifo:<prio> or nice:<value>: " +
+                                         priority_);
+            }
+            policy = priority_.substr(0, colon);
+            priority = std::stoi(priority_.substr(colon + 1));
+            if (policy != "fifo" && policy != "nice") {
+                throw std::runtime_error("Unknown scheduling policy: " + policy);
+            }
+        }
+    }
+
+    // to be called from within the measurement thread
+    void apply() const
+    {
+        pthread_t self = pthread_self();
+
+        // names are limited to 15 characters
+        int ret = pthread_setname_np(self, name.substr(0, 15).c_str());
+        if (ret != 0) {
+            logging::warn() << "Could not set name of measurement thread: " << std::strerror(ret);
+        }
+
+        if (!cpus.empty()) {
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            for (int cpu : cpus) {
+                if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                    CPU_SET(cpu, &mask);
+                }
+            }
+            ret = pthread_setaffinity_np(self, sizeof(mask), &mask);
+            if (ret != 0) {
+                logging::warn() << "Could not pin measurement thread: " << std::strerror(ret);
+            }
+        }
+
+        if (policy == "fifo") {
+            sched_param param;
+            param.sched_priority = priority;
+            ret = pthread_setschedparam(self, SCHED_FIFO, &param);
+            if (ret != 0) {
+                logging::warn() << "Could not set SCHED_FIFO priority " << priority
+                                << " for measurement thread: " << std::strerror(ret);
+            }
+        }
+        else if (policy == "nice") {
+            // on Linux the nice value is per thread
+            pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+            if (setpriority(PRIO_PROCESS, tid, priority) != 0) {
+                logging::warn() << "Could not set nice value " << priority
+                                << " for measurement thread: " << std::strerror(errno);
+            }
+        }
+    }
+
+    // CPUs a thread placed near a device may use: an explicit CPUS list, otherwise all CPUs
+    // of the process, the single housekeeping CPU of "auto" gives way to the NUMA placement
+    std::vector<int> numa_scope() const
+    {
+        return automatic ? std::vector<int>() : cpus;
+    }
+
+private:
+    std::string name;
+    std::vector<int> cpus;
+    bool automatic = false;
+    std::string policy;
+    int priority = 0;
+};
+
+/** Moves the calling thread next to a device: onto those of cpus within scope (see
+ *  thread_placement::numa_scope, empty means the CPUs the process may run on) and its
+ *  allocations to memory of numa_node, so that storage it touches first is local to the device.
+ *  Empty cpus and numa_node -1 leave that part as is.
+ */
+inline void place_near_device(const std::vector<int>& cpus, int numa_node, const std::vector<int>& scope)
+{
+    pthread_t self = pthread_self();
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (!scope.empty()) {
+        for (int cpu : scope) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &allowed);
+            }
+        }
+    }
+    else {
+        // the process mask, not the one of this thread, which may be pinned to CPUS=auto
+        for (int cpu : read_allowed_cpus()) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &allowed);
+            }
+        }
+    }
+    if (!cpus.empty() && CPU_COUNT(&allowed) > 0) {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        for (int cpu : cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                CPU_SET(cpu, &mask);
+            }
+        }
+        if (CPU_COUNT(&mask) == 0) {
+            logging::info() << "No allowed CPU is close to NUMA node " << numa_node
+                            << ", measurement thread stays where it is";
+        }
+        else {
+            int ret = pthread_setaffinity_np(self, sizeof(mask), &mask);
+            if (ret != 0) {
+                logging::warn() << "Could not pin measurement thread: " << std::strerror(ret);
+            }
+        }
+    }
+
+    if (numa_node >= 0 && numa_node < 1024) {
+        unsigned long nodes[1024 / (8 * sizeof(unsigned long))] = {};
+        nodes[numa_node / (8 * sizeof(unsigned long))] = 1ul << (numa_node % (8 * sizeof(unsigned long)));
+        // the kernel expects one more than the number of bits
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes, 8 * sizeof(nodes) + 1) != 0) {
+            logging::warn() << "Could not prefer memory of NUMA node " << numa_node
+                            << " for measurement thread: " << std::strerror(errno);
+        }
+    }
+}
+
+#endif // SCOREP_PLUGIN_NVML_NVML_THREAD_PLACEMENT_HPP
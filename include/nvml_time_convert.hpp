@@ -0,0 +1,83 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_TIME_CONVERT_HPP
+#define SCOREP_PLUGIN_NVML_NVML_TIME_CONVERT_HPP
+
+#include "nvml_types.hpp"
+
+#include <scorep/chrono/chrono.hpp>
+
+#include <algorithm>
+#include <vector>
+
+/** Maps system clock time points to Score-P ticks, linear between each two adjacent
+ *  synchronisation points instead of between start and stop only. Drift of the two clocks
+ *  over a long run is thus bounded by the distance of the synchronisation points.
+ *  Time points outside the synchronised range use the first or last segment.
+ */
+class piecewise_time_convert {
+public:
+    void synchronize_point(system_time_point_t local, scorep::chrono::ticks remote)
+    {
+        points.emplace_back(local, remote);
+        segments.clear();
+    }
+
+    // builds the conversion, afterwards to_ticks can be called from several threads
+    void prepare()
+    {
+        if (segments.empty()) {
+            build();
+        }
+    }
+
+    scorep::chrono::ticks to_ticks(system_time_point_t local)
+    {
+        if (segments.empty()) {
+            build();
+        }
+
+        auto it = std::upper_bound(bounds.begin(), bounds.end(), local);
+        return segments[it - bounds.begin()].to_ticks(local);
+    }
+
+private:
+    void build()
+    {
+        std::stable_sort(points.begin(), points.end(),
+                         [](const sync_point_t& a, const sync_point_t& b) {
+                             return a.first < b.first;
+                         });
+        // a segment needs two distinct local time points
+        points.erase(std::unique(points.begin(), points.end(),
+                                 [](const sync_point_t& a, const sync_point_t& b) {
+                                     return a.first == b.first;
+                                 }),
+                     points.end());
+
+        bounds.clear();
+        if (points.size() < 2) {
+            segments.emplace_back();
+            for (auto& point : points) {
+                segments.back().synchronize_point(point.first, point.second);
+            }
+            return;
+        }
+
+        for (std::size_t i = 0; i + 1 < points.size(); ++i) {
+            segments.emplace_back();
+            segments.back().synchronize_point(points[i].first, points[i].second);
+            segments.back().synchronize_point(points[i + 1].first, points[i + 1].second);
+
+            if (i > 0) {
+                bounds.push_back(points[i].first);
+            }
+        }
+    }
+
+    std::vector<sync_point_t> points;
+
+    // segments[i] is used for time points before bounds[i], the last one for all after
+    std::vector<system_time_point_t> bounds;
+    std::vector<scorep::chrono::time_convert<>> segments;
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_TIME_CONVERT_HPP
@@ -0,0 +1,122 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_TOPOLOGY_HPP
+#define SCOREP_PLUGIN_NVML_NVML_TOPOLOGY_HPP
+
+#include "nvml_loader.hpp"
+#include "nvml_runtime.hpp"
+#include "nvml_wrapper.hpp"
+
+#include <nvml.h>
+
+#include <scorep/plugin/plugin.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using scorep::plugin::logging;
+
+// enough for CPU_SETSIZE CPUs
+enum : unsigned int { affinity_words = 1024 / (8 * sizeof(unsigned long)) };
+
+// the set bits of an NVML affinity mask
+inline std::vector<int> affinity_bits(const unsigned long* mask)
+{
+    std::vector<int> bits;
+    for (unsigned int word = 0; word < affinity_words; ++word) {
+        for (unsigned int bit = 0; bit < 8 * sizeof(unsigned long); ++bit) {
+            if (mask[word] & (1ul << bit)) {
+                bits.push_back(word * 8 * sizeof(unsigned long) + bit);
+            }
+        }
+    }
+    return bits;
+}
+
+// the devices visible to the process, uncached
+inline std::vector<nvml_device_info> enumerate_devices()
+{
+    std::vector<nvml_device_info> result;
+
+    if (nvml_replayer() != nullptr) {
+        for (std::uint32_t i = 0; i < nvml_replayer()->device_count(); ++i) {
+            result.push_back({ replay_device(i), i, "replay", "", "" });
+        }
+        return result;
+    }
+
+    unsigned int num_devices;
+    nvmlReturn_t ret = nvml_lib().nvmlDeviceGetCount(&num_devices);
+    check_nvml_return(ret, "nvmlDeviceGetCount");
+    if (nvml_recorder() != nullptr) {
+        nvml_recorder()->device_count(num_devices);
+    }
+
+    /*
+     * New nvmlDeviceGetCount_v2 (default in NVML 5.319) returns count of all devices in the system
+     * even if nvmlDeviceGetHandleByIndex_v2 returns NVML_ERROR_NO_PERMISSION for such device.
+     */
+    for (unsigned int i = 0; i < num_devices; ++i) {
+        nvml_device_info info;
+        ret = nvml_lib().nvmlDeviceGetHandleByIndex(i, &info.device);
+        if (NVML_ERROR_NO_PERMISSION == ret) {
+            logging::info() << "No permission for device: " << i;
+            continue;
+        }
+        if (NVML_SUCCESS != ret) {
+            throw std::runtime_error(nvml_lib().nvmlErrorString(ret));
+        }
+        info.index = i;
+
+        // large enough for the v2 sizes of all strings, they are only informational
+        char buffer[96] = {};
+        if (NVML_SUCCESS == nvml_lib().nvmlDeviceGetName(info.device, buffer, sizeof(buffer))) {
+            info.name = buffer;
+        }
+        buffer[0] = '\0';
+        if (NVML_SUCCESS == nvml_lib().nvmlDeviceGetUUID(info.device, buffer, sizeof(buffer))) {
+            info.uuid = buffer;
+        }
+        nvmlPciInfo_t pci = {};
+        if (NVML_SUCCESS == nvml_lib().nvmlDeviceGetPciInfo(info.device, &pci)) {
+            info.pci_bus_id = pci.busId;
+        }
+
+        unsigned long mask[affinity_words] = {};
+        if (NVML_SUCCESS ==
+            nvml_lib().nvmlDeviceGetCpuAffinity(info.device, affinity_words, mask)) {
+            info.cpus = affinity_bits(mask);
+        }
+        std::fill(mask, mask + affinity_words, 0);
+        if (NVML_SUCCESS == nvml_lib().nvmlDeviceGetMemoryAffinity(
+                                info.device, affinity_words, mask, NVML_AFFINITY_SCOPE_NODE)) {
+            std::vector<int> nodes = affinity_bits(mask);
+            if (!nodes.empty()) {
+                info.numa_node = nodes.front();
+            }
+        }
+
+        logging::info() << "CUDA device " << i << ": " << info.name << " " << info.uuid
+                        << " at " << info.pci_bus_id << " on NUMA node " << info.numa_node;
+        result.push_back(info);
+    }
+    return result;
+}
+
+/** Enumerates the devices once per process, as every plugin needs them for every metric.
+ *  NVML must be initialized (or a replay active).
+ */
+inline const std::vector<nvml_device_info>& nvml_topology()
+{
+    nvml_runtime& runtime = nvml_runtime::instance();
+    std::lock_guard<std::mutex> lock(runtime.mutex);
+    if (!runtime.topology_built) {
+        runtime.devices = enumerate_devices();
+        runtime.topology_built = true;
+    }
+    return runtime.devices;
+}
+
+#endif // SCOREP_PLUGIN_NVML_NVML_TOPOLOGY_HPP
@@ -0,0 +1,131 @@
+#ifndef SCOREP_PLUGIN_NVML_NVML_TRIGGER_HPP
+#define SCOREP_PLUGIN_NVML_NVML_TRIGGER_HPP
+
+#include "nvml_types.hpp"
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** A condition of triggered capture on the values of one metric:
+ *    power_usage>250000     above a threshold
+ *    utilization_gpu<10     below a threshold
+ *    throttle_reasons~      any change
+ *  Each handle of the metric evaluates its own copy.
+ */
+struct trigger_condition {
+    std::string metric;
+    char op;
+    double threshold = 0;
+
+    bool has_previous = false;
+    double previous = 0;
+
+    bool fires(double value)
+    {
+        bool changed = has_previous && value != previous;
+        has_previous = true;
+        previous = value;
+        switch (op) {
+        case '>':
+            return value > threshold;
+        case '<':
+            return value < threshold;
+        default:
+            return changed;
+        }
+    }
+};
+
+// comma separated conditions, e.g. "power_usage>250000,throttle_reasons~"
+inline std::vector<trigger_condition> parse_triggers(const std::string& text)
+{
+    std::vector<trigger_condition> conditions;
+    std::size_t begin = 0;
+    while (begin <= text.size()) {
+        std::size_t end = text.find(',', begin);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string item = text.substr(begin, end - begin);
+        begin = end + 1;
+        if (item.empty()) {
+            continue;
+        }
+
+        std::size_t pos = item.find_first_of("<>~");
+        if (pos == 0 || pos == std::string::npos) {
+            throw std::runtime_error("Invalid trigger " + item +
+                                     ", expected <metric>>N, <metric><N or <metric>~");
+        }
+        trigger_condition condition;
+        condition.metric = item.substr(0, pos);
+        condition.op = item[pos];
+        if (condition.op == '~') {
+            if (pos + 1 != item.size()) {
+                throw std::runtime_error("Invalid trigger " + item + ", nothing may follow ~");
+            }
+        }
+        else {
+            char* number_end;
+            const char* number = item.c_str() + pos + 1;
+            condition.threshold = std::strtod(number, &number_end);
+            if (number_end == number || *number_end != '\0') {
+                throw std::runtime_error("Invalid threshold in trigger " + item);
+            }
+        }
+        conditions.push_back(condition);
+    }
+    return conditions;
+}
+
+/** The latest points of a handle in triggered capture, fixed size.
+ */
+class capture_ring {
+public:
+    void resize(std::size_t capacity)
+    {
+        points.assign(capacity, pair_chrono_value_t());
+        next = 0;
+        size = 0;
+    }
+
+    void push(system_time_point_t timestamp, std::uint64_t value)
+    {
+        if (points.empty()) {
+            return;
+        }
+        points[next] = std::make_pair(timestamp, value);
+        next = (next + 1) % points.size();
+        if (size < points.size()) {
+            ++size;
+        }
+    }
+
+    /** Appends the points to values, oldest first, and empties the ring. Points in values that
+     *  are also in the ring (coarse points) are taken back first, so values stays ordered by time.
+     */
+    void commit(std::vector<pair_chrono_value_t>& values)
+    {
+        if (size == 0) {
+            return;
+        }
+        std::size_t oldest = (next + points.size() - size) % points.size();
+        while (!values.empty() && values.back().first >= points[oldest].first) {
+            values.pop_back();
+        }
+        for (std::size_t i = 0; i < size; ++i) {
+            values.push_back(points[(oldest + i) % points.size()]);
+        }
+        size = 0;
+    }
+
+private:
+    std::vector<pair_chrono_value_t> points;
+    std::size_t next = 0;
+    std::size_t size = 0;
+};
+
+#endif // SCOREP_PLUGIN_NVML_NVML_TRIGGER_HPP
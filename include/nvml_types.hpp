@@ -11,19 +11,70 @@
 using system_clock_t = std::chrono::system_clock;
 using system_time_point_t = std::chrono::time_point<system_clock_t>;
 
+// schedules of the measurement threads, unaffected by changes of the system time
+using steady_clock_t = std::chrono::steady_clock;
+
 using pair_chrono_value_t = std::pair<system_time_point_t, std::uint64_t>;
 
+// a system clock time point and the Score-P ticks taken at the same moment
+using sync_point_t = std::pair<system_time_point_t, scorep::chrono::ticks>;
+
 using scorep::plugin::logging;
 
+// polling interval requested for a metric (e.g. "power_usage:10ms"), 0 if it has none
+inline std::chrono::milliseconds metric_interval(const Nvml_Metric* metric)
+{
+    return metric != nullptr ? metric->get_interval() : std::chrono::milliseconds(0);
+}
+
+inline std::chrono::milliseconds metric_interval(const Hybrid_Metric* metric)
+{
+    return metric != nullptr ? metric->get_interval() : std::chrono::milliseconds(0);
+}
+
+// sampled and event metrics have no interval of their own
+template <typename T>
+inline std::chrono::milliseconds metric_interval(const T*)
+{
+    return std::chrono::milliseconds(0);
+}
+
+// tells the metric the NVML index of a device it got a handle on, see Nvml_Metric::bind_device
+inline void bind_metric_device(Nvml_Metric* metric, nvmlDevice_t device, unsigned int device_idx)
+{
+    metric->bind_device(device, device_idx);
+}
+
+inline void bind_metric_device(Hybrid_Metric* metric, nvmlDevice_t device, unsigned int device_idx)
+{
+    metric->get_polled()->bind_device(device, device_idx);
+}
+
+template <typename T>
+inline void bind_metric_device(T*, nvmlDevice_t, unsigned int)
+{
+}
+
 template <typename T>
 class nvml_t {
 public:
     nvml_t(const std::string& name_, nvmlDevice_t device_, T* metric_)
         : name(name_), device(device_), metric(metric_)
     {
-        nvmlReturn_t ret = nvmlDeviceGetIndex(device, &device_idx);
+        if (nvml_replayer() != nullptr) {
+            device_idx = replay_device_index(device);
+            return;
+        }
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetIndex(device, &device_idx);
         check_nvml_return(ret);
+        bind_metric_device(metric, device, device_idx);
     }
+    // handle of a metric about the plugin itself, not bound to a device
+    explicit nvml_t(const std::string& name_)
+        : name(name_), metric(nullptr), device_idx(0), device(nullptr)
+    {
+    }
+
     ~nvml_t()
     {
         logging::info() << "call destructor of " << name;
@@ -38,9 +89,12 @@ public:
     //    /* move assignment */
     //    nvml_t& operator=(nvml_t&&) = default;
 
+    // the same metric with different intervals, e.g. "power_usage" and "power_usage:10ms",
+    // gives different handles
     bool operator==(const nvml_t& other) const
     {
-        return (this->name == other.name) && (this->device_idx == this->device_idx);
+        return (this->name == other.name) && (this->device_idx == other.device_idx) &&
+               metric_interval(this->metric) == metric_interval(other.metric);
     }
 
     std::string name;
@@ -59,13 +113,14 @@ inline ostream& operator<<(ostream& s, const nvml_t<T>& metric)
     return s;
 }
 
-/** hashing using the metric name and device id
+/** hashing using the metric name, device id and interval
  */
 template <typename T>
 struct hash<nvml_t<T>> {
     size_t inline operator()(const nvml_t<T>& metric) const
     {
-        return std::hash<std::string>{}(metric.name + std::to_string(metric.device_idx));
+        return (std::hash<std::string>{}(metric.name) * 31 + metric.device_idx) * 31 +
+               metric_interval(metric.metric).count();
     }
 };
 };     // namespace std
@@ -1,8 +1,21 @@
 #ifndef SCOREP_PLUGIN_NVML_NVML_WRAPPER_HPP
 #define SCOREP_PLUGIN_NVML_NVML_WRAPPER_HPP
 
+#include "nvml_counter.hpp"
+#include "nvml_loader.hpp"
+#include "nvml_runtime.hpp"
+
 #include <nvml.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -38,15 +51,46 @@ inline static void check_nvml_return(nvmlReturn_t ret,
     }
 }
 
+// metrics with datatype DOUBLE pass their values as bit pattern in std::uint64_t
+inline std::uint64_t double_to_bits(double value)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline double bits_to_double(std::uint64_t bits)
+{
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
 class Nvml_Metric {
 public:
-    virtual unsigned int get_value(nvmlDevice_t& device) = 0;
+    virtual ~Nvml_Metric() = default;
+
+    // reads the current value, does not throw so it can be used on the hot path
+    virtual nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value) = 0;
+
+    // checks once whether the metric can be read on device
+    nvmlReturn_t probe(nvmlDevice_t& device)
+    {
+        std::uint64_t value;
+        return read(device, value);
+    }
 
     const std::string& get_name() const
     {
         return name;
     }
 
+    // NVML entry point used by read(), for overhead statistics
+    const char* get_api() const
+    {
+        return api;
+    }
+
     const std::string& get_desc() const
     {
         return desc;
@@ -67,15 +111,58 @@ public:
         return datatype;
     }
 
+    // width of a raw counter that read() returns, 0 if the metric is no counter.
+    // Counters of type ABS are reported as rate per second, ACCU as total since start.
+    unsigned int get_counter_bits() const
+    {
+        return counter_bits;
+    }
+
+    // factor from counter units to the unit of the metric, e.g. 1024 for KiB
+    std::uint64_t get_counter_scale() const
+    {
+        return counter_scale;
+    }
+
+    // false if one value is measured for all devices together (e.g. a sum over them)
+    virtual bool is_per_device() const
+    {
+        return true;
+    }
+
+    // a handle of the metric on device with NVML index device_idx was created, see nvml_t
+    virtual void bind_device(nvmlDevice_t device, unsigned int device_idx)
+    {
+    }
+
+    // reads that block for a noticeable time, they are polled apart from the others
+    bool is_blocking() const
+    {
+        return blocking;
+    }
+
+    // polling interval requested for this metric, 0 for the interval of the plugin
+    std::chrono::milliseconds get_interval() const
+    {
+        return interval;
+    }
+
+    void set_interval(std::chrono::milliseconds interval_)
+    {
+        interval = interval_;
+    }
+
 protected:
     std::string name;
     std::string desc;
     std::string unit;
     metric_measure_type type;
     metric_datatype datatype;
-
-protected:
-    unsigned int value;
+    const char* api = "";
+    unsigned int counter_bits = 0;
+    std::uint64_t counter_scale = 1;
+    bool blocking = false;
+    std::chrono::milliseconds interval{ 0 };
 };
 
 class Power : public Nvml_Metric {
@@ -87,14 +174,16 @@ public:
         unit = "mW";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetPowerUsage";
     }
 
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
-        nvmlReturn_t ret = nvmlDeviceGetPowerUsage(device, &value);
-        check_nvml_return(ret, name);
+        unsigned int reading = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetPowerUsage(device, &reading);
+        value = reading;
 
-        return value;
+        return ret;
     }
 };
 
@@ -107,15 +196,17 @@ public:
         unit = "°C";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetTemperature";
     }
 
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
-        nvmlReturn_t ret = nvmlDeviceGetTemperature(
-            device, nvmlTemperatureSensors_t::NVML_TEMPERATURE_GPU, &value);
-        check_nvml_return(ret, name);
+        unsigned int reading = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetTemperature(
+            device, nvmlTemperatureSensors_t::NVML_TEMPERATURE_GPU, &reading);
+        value = reading;
 
-        return value;
+        return ret;
     }
 };
 
@@ -128,15 +219,16 @@ public:
         unit = "MHz";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetClockInfo";
     }
 
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
-        nvmlReturn_t ret =
-            nvmlDeviceGetClockInfo(device, nvmlClockType_t::NVML_CLOCK_SM, &value);
-        check_nvml_return(ret, name);
+        unsigned int reading = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetClockInfo(device, nvmlClockType_t::NVML_CLOCK_SM, &reading);
+        value = reading;
 
-        return value;
+        return ret;
     }
 };
 
@@ -149,15 +241,16 @@ public:
         unit = "MHz";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetClockInfo";
     }
 
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
-        nvmlReturn_t ret =
-            nvmlDeviceGetClockInfo(device, nvmlClockType_t::NVML_CLOCK_MEM, &value);
-        check_nvml_return(ret, name);
+        unsigned int reading = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetClockInfo(device, nvmlClockType_t::NVML_CLOCK_MEM, &reading);
+        value = reading;
 
-        return value;
+        return ret;
     }
 };
 
@@ -170,14 +263,16 @@ public:
         unit = "";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetFanSpeed";
     }
 
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
-        nvmlReturn_t ret = nvmlDeviceGetFanSpeed(device, &value);
-        check_nvml_return(ret, name);
+        unsigned int reading = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetFanSpeed(device, &reading);
+        value = reading;
 
-        return value;
+        return ret;
     }
 };
 
@@ -190,16 +285,18 @@ public:
         unit = "Bytes";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetMemoryInfo";
     }
 
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
         nvmlMemory_t mem;
-        nvmlReturn_t ret = nvmlDeviceGetMemoryInfo(device, &mem);
-        check_nvml_return(ret, name);
-        value = mem.free;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetMemoryInfo(device, &mem);
+        if (NVML_SUCCESS == ret) {
+            value = mem.free;
+        }
 
-        return value;
+        return ret;
     }
 };
 
@@ -212,15 +309,17 @@ public:
         unit = "Bytes";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetMemoryInfo";
     }
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
         nvmlMemory_t mem;
-        nvmlReturn_t ret = nvmlDeviceGetMemoryInfo(device, &mem);
-        check_nvml_return(ret, name);
-        value = mem.used;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetMemoryInfo(device, &mem);
+        if (NVML_SUCCESS == ret) {
+            value = mem.used;
+        }
 
-        return value;
+        return ret;
     }
 };
 
@@ -233,15 +332,17 @@ public:
         unit = "Bytes";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetMemoryInfo";
     }
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
         nvmlMemory_t mem;
-        nvmlReturn_t ret = nvmlDeviceGetMemoryInfo(device, &mem);
-        check_nvml_return(ret, name);
-        value = mem.total;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetMemoryInfo(device, &mem);
+        if (NVML_SUCCESS == ret) {
+            value = mem.total;
+        }
 
-        return value;
+        return ret;
     }
 };
 
@@ -254,14 +355,18 @@ public:
         unit = "Bytes";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetPcieThroughput";
+        // the driver samples over about 20 ms before it returns
+        blocking = true;
     }
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
-        nvmlReturn_t ret = nvmlDeviceGetPcieThroughput(
-            device, nvmlPcieUtilCounter_t::NVML_PCIE_UTIL_TX_BYTES, &value);
-        check_nvml_return(ret, name);
+        unsigned int reading = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetPcieThroughput(
+            device, nvmlPcieUtilCounter_t::NVML_PCIE_UTIL_TX_BYTES, &reading);
+        value = reading;
 
-        return value;
+        return ret;
     }
 };
 
@@ -274,14 +379,17 @@ public:
         unit = "Bytes";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetPcieThroughput";
+        blocking = true;
     }
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
-        nvmlReturn_t ret = nvmlDeviceGetPcieThroughput(
-            device, nvmlPcieUtilCounter_t::NVML_PCIE_UTIL_RX_BYTES, &value);
-        check_nvml_return(ret, name);
+        unsigned int reading = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetPcieThroughput(
+            device, nvmlPcieUtilCounter_t::NVML_PCIE_UTIL_RX_BYTES, &reading);
+        value = reading;
 
-        return value;
+        return ret;
     }
 };
 
@@ -294,15 +402,17 @@ public:
         unit = "%";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetUtilizationRates";
     }
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
         nvmlUtilization_t util;
-        nvmlReturn_t ret = nvmlDeviceGetUtilizationRates(device, &util);
-        check_nvml_return(ret, name);
-        value = util.gpu;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetUtilizationRates(device, &util);
+        if (NVML_SUCCESS == ret) {
+            value = util.gpu;
+        }
 
-        return value;
+        return ret;
     }
 };
 
@@ -315,15 +425,17 @@ public:
         unit = "%";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetUtilizationRates";
     }
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
         nvmlUtilization_t util;
-        nvmlReturn_t ret = nvmlDeviceGetUtilizationRates(device, &util);
-        check_nvml_return(ret, name);
-        value = util.memory;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetUtilizationRates(device, &util);
+        if (NVML_SUCCESS == ret) {
+            value = util.memory;
+        }
 
-        return value;
+        return ret;
     }
 };
 
@@ -336,13 +448,15 @@ public:
         unit = "MHz";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetApplicationsClock";
     }
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
-        nvmlReturn_t ret = nvmlDeviceGetApplicationsClock(device, NVML_CLOCK_MEM, &value);
-        check_nvml_return(ret, name);
+        unsigned int reading = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetApplicationsClock(device, NVML_CLOCK_MEM, &reading);
+        value = reading;
 
-        return value;
+        return ret;
     }
 };
 
@@ -355,13 +469,15 @@ public:
         unit = "MHz";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetApplicationsClock";
     }
-    unsigned int get_value(nvmlDevice_t& device)
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
-        nvmlReturn_t ret = nvmlDeviceGetApplicationsClock(device, NVML_CLOCK_SM, &value);
-        check_nvml_return(ret, name);
+        unsigned int reading = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetApplicationsClock(device, NVML_CLOCK_SM, &reading);
+        value = reading;
 
-        return value;
+        return ret;
     }
 };
 
@@ -374,17 +490,528 @@ public:
         unit = "MHz";
         type = metric_measure_type::ABS;
         datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetApplicationsClock";
+    }
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
+    {
+        unsigned int reading = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetApplicationsClock(device, NVML_CLOCK_GRAPHICS, &reading);
+        value = reading;
+
+        return ret;
+    }
+};
+
+/** Energy used by the device, read from the total energy counter of the driver (Volta or newer).
+ *  Reported as energy since the start of the measurement, so Score-P attributes the energy used
+ *  within a region from one cheap read per event.
+ */
+class Energy : public Nvml_Metric {
+public:
+    Energy(std::string name_ = "")
+    {
+        name = name_;
+        desc = "Energy Consumption";
+        unit = "mJ";
+        type = metric_measure_type::ACCU;
+        datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetTotalEnergyConsumption";
+        counter_bits = 64;
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
+    {
+        unsigned long long reading = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetTotalEnergyConsumption(device, &reading);
+        value = reading;
+
+        return ret;
+    }
+};
+
+class Throttle_Reasons : public Nvml_Metric {
+public:
+    Throttle_Reasons(std::string name_ = "")
+    {
+        name = name_;
+        desc = "Clock throttle reasons bitmask (nvmlClocksThrottleReason*)";
+        unit = "";
+        type = metric_measure_type::ABS;
+        datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetCurrentClocksThrottleReasons";
     }
-    unsigned int get_value(nvmlDevice_t& device)
+
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
     {
-        nvmlReturn_t ret =
-            nvmlDeviceGetApplicationsClock(device, NVML_CLOCK_GRAPHICS, &value);
-        check_nvml_return(ret, name);
+        unsigned long long reasons = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetCurrentClocksThrottleReasons(device, &reasons);
+        value = reasons;
 
-        return value;
+        return ret;
     }
 };
 
+/** Time the clocks were held below the requested ones by a performance policy, from the
+ *  violation counter of the driver. Reported as time since the start of the measurement.
+ */
+class Violation_Time : public Nvml_Metric {
+public:
+    Violation_Time(std::string name_, nvmlPerfPolicyType_t policy_)
+        : policy(policy_)
+    {
+        name = name_;
+        switch (policy) {
+        case NVML_PERF_POLICY_POWER:
+            desc = "Time throttled by the power limit";
+            break;
+        case NVML_PERF_POLICY_THERMAL:
+            desc = "Time throttled by the thermal limit";
+            break;
+        default:
+            desc = "Time throttled for board reliability";
+        }
+        unit = "ns";
+        type = metric_measure_type::ACCU;
+        datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetViolationStatus";
+        counter_bits = 64;
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
+    {
+        nvmlViolationTime_t violation = {};
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetViolationStatus(device, policy, &violation);
+        value = violation.violationTime;
+
+        return ret;
+    }
+
+private:
+    nvmlPerfPolicyType_t policy;
+};
+
+// link id used by NVML for the sum over all NVLinks of a device
+static constexpr unsigned int nvlink_all_links = 0xFFFFFFFF;
+
+// splits "nvlink_tx_link3" into "nvlink_tx" and 3, link is nvlink_all_links without suffix
+inline std::string nvlink_split_name(const std::string& metric_name, unsigned int& link)
+{
+    link = nvlink_all_links;
+    std::size_t pos = metric_name.rfind("_link");
+    if (pos == std::string::npos || pos + 5 == metric_name.size() ||
+        metric_name.find_first_not_of("0123456789", pos + 5) != std::string::npos) {
+        return metric_name;
+    }
+    link = std::stoul(metric_name.substr(pos + 5));
+    if (link >= NVML_NVLINK_MAX_LINKS) {
+        throw std::runtime_error("Invalid NVLink in metric: " + metric_name);
+    }
+    return metric_name.substr(0, pos);
+}
+
+/** NVLink data throughput from the field values NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX/RX.
+ *  The raw counters are in KiB and converted to bytes per second.
+ */
+class Nvlink_Throughput : public Nvml_Metric {
+public:
+    Nvlink_Throughput(std::string name_, unsigned int field_, unsigned int link_)
+        : field(field_), link(link_)
+    {
+        name = name_;
+        desc = field == NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX ? "NVLink send throughput"
+                                                              : "NVLink receive throughput";
+        if (link != nvlink_all_links) {
+            desc += " of link " + std::to_string(link);
+        }
+        unit = "B/s";
+        type = metric_measure_type::ABS;
+        datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetFieldValues";
+        counter_bits = 64;
+        counter_scale = 1024;
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
+    {
+        nvmlFieldValue_t field_value = {};
+        field_value.fieldId = field;
+        field_value.scopeId = link;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetFieldValues(device, 1, &field_value);
+        if (NVML_SUCCESS != ret) {
+            return ret;
+        }
+        if (NVML_SUCCESS != field_value.nvmlReturn) {
+            return field_value.nvmlReturn;
+        }
+        value = field_value.value.ullVal;
+
+        return NVML_SUCCESS;
+    }
+
+private:
+    unsigned int field;
+    unsigned int link;
+};
+
+/** NVLink error counters, of one link or summed over all links of the device that have one.
+ *  Reported as number of errors since the start of the measurement.
+ */
+class Nvlink_Errors : public Nvml_Metric {
+public:
+    Nvlink_Errors(std::string name_, nvmlNvLinkErrorCounter_t counter_, unsigned int link_)
+        : counter(counter_), link(link_)
+    {
+        name = name_;
+        switch (counter) {
+        case NVML_NVLINK_ERROR_DL_REPLAY:
+            desc = "NVLink replay errors";
+            break;
+        case NVML_NVLINK_ERROR_DL_RECOVERY:
+            desc = "NVLink recovery errors";
+            break;
+        case NVML_NVLINK_ERROR_DL_CRC_FLIT:
+            desc = "NVLink CRC flit errors";
+            break;
+        default:
+            desc = "NVLink CRC data errors";
+        }
+        if (link != nvlink_all_links) {
+            desc += " of link " + std::to_string(link);
+        }
+        unit = "#";
+        type = metric_measure_type::ACCU;
+        datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetNvLinkErrorCounter";
+        counter_bits = 64;
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
+    {
+        unsigned long long reading = 0;
+        if (link != nvlink_all_links) {
+            nvmlReturn_t ret =
+                nvml_lib().nvmlDeviceGetNvLinkErrorCounter(device, link, counter, &reading);
+            value = reading;
+            return ret;
+        }
+
+        device_links* links = find_links(device);
+        if (links == nullptr) {
+            // no handle on device yet, e.g. when probed
+            nvmlReturn_t ret = NVML_ERROR_NOT_SUPPORTED;
+            value = 0;
+            for (unsigned int l = 0; l < NVML_NVLINK_MAX_LINKS; ++l) {
+                if (NVML_SUCCESS ==
+                    nvml_lib().nvmlDeviceGetNvLinkErrorCounter(device, l, counter, &reading)) {
+                    value += reading;
+                    ret = NVML_SUCCESS;
+                }
+            }
+            return ret;
+        }
+
+        // links that stop answering are left out. The errors of each link are counted on their
+        // own, so the sum does not drop when a link stops answering and a reset of one link does
+        // not affect the others.
+        nvmlReturn_t ret = NVML_ERROR_NOT_SUPPORTED;
+        std::uint64_t sum = 0;
+        for (unsigned int l : links->active) {
+            nvmlReturn_t link_ret =
+                nvml_lib().nvmlDeviceGetNvLinkErrorCounter(device, l, counter, &reading);
+            if (NVML_SUCCESS == link_ret) {
+                links->counters[l].update(reading, std::chrono::system_clock::time_point(), 64, 1,
+                                          false, links->totals[l]);
+                ret = NVML_SUCCESS;
+            }
+            sum += links->totals[l];
+        }
+        value = sum;
+
+        return ret;
+    }
+
+    // the links of device that exist and are supported are looked up once, so reads do not
+    // try all NVML_NVLINK_MAX_LINKS
+    void bind_device(nvmlDevice_t device, unsigned int device_idx) override
+    {
+        if (link != nvlink_all_links || find_links(device) != nullptr) {
+            return;
+        }
+        link_states.emplace_back();
+        device_links& links = link_states.back();
+        links.device = device;
+        for (unsigned int l = 0; l < NVML_NVLINK_MAX_LINKS; ++l) {
+            unsigned long long reading;
+            if (NVML_SUCCESS ==
+                nvml_lib().nvmlDeviceGetNvLinkErrorCounter(device, l, counter, &reading)) {
+                links.active.push_back(l);
+            }
+        }
+    }
+
+private:
+    // errors per link since its first reading
+    struct device_links {
+        nvmlDevice_t device;
+        std::vector<unsigned int> active;
+        counter_state counters[NVML_NVLINK_MAX_LINKS];
+        std::uint64_t totals[NVML_NVLINK_MAX_LINKS] = {};
+    };
+
+    device_links* find_links(nvmlDevice_t device)
+    {
+        for (auto& links : link_states) {
+            if (links.device == device) {
+                return &links;
+            }
+        }
+        return nullptr;
+    }
+
+    nvmlNvLinkErrorCounter_t counter;
+    unsigned int link;
+    // filled by bind_device before the measurement, the state of a device is only changed by
+    // the thread that polls it
+    std::vector<device_links> link_states;
+};
+
+// NVLink metrics, optionally with a _link<N> suffix, nullptr for other names
+inline Nvml_Metric* metric_name_2_nvlink_function(const std::string& metric_name)
+{
+    unsigned int link;
+    std::string base_name = nvlink_split_name(metric_name, link);
+    if (base_name == "nvlink_tx") {
+        return new Nvlink_Throughput(metric_name, NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX, link);
+    }
+    if (base_name == "nvlink_rx") {
+        return new Nvlink_Throughput(metric_name, NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_RX, link);
+    }
+    if (base_name == "nvlink_replay_errors") {
+        return new Nvlink_Errors(metric_name, NVML_NVLINK_ERROR_DL_REPLAY, link);
+    }
+    if (base_name == "nvlink_recovery_errors") {
+        return new Nvlink_Errors(metric_name, NVML_NVLINK_ERROR_DL_RECOVERY, link);
+    }
+    if (base_name == "nvlink_crc_flit_errors") {
+        return new Nvlink_Errors(metric_name, NVML_NVLINK_ERROR_DL_CRC_FLIT, link);
+    }
+    if (base_name == "nvlink_crc_data_errors") {
+        return new Nvlink_Errors(metric_name, NVML_NVLINK_ERROR_DL_CRC_DATA, link);
+    }
+    return nullptr;
+}
+
+#ifdef NVML_GPM_METRICS_GET_VERSION
+/** Two GPU Performance Monitoring samples of one device (Hopper or newer), GPM metrics are
+ *  computed by NVML from their difference. The pair is shared by all GPM metrics of the device:
+ *  a metric that reads the pair it has read before takes a new sample, so the first GPM metric
+ *  of a sweep samples the device and the others use the same pair. Values cover the time
+ *  between the two latest samples, the first read only takes a sample and returns NaN.
+ */
+class gpm_sampler {
+public:
+    gpm_sampler() = default;
+
+    ~gpm_sampler()
+    {
+        for (auto sample : samples) {
+            if (sample != nullptr) {
+                nvml_lib().nvmlGpmSampleFree(sample);
+            }
+        }
+    }
+
+    gpm_sampler(const gpm_sampler&) = delete;
+    gpm_sampler& operator=(const gpm_sampler&) = delete;
+
+    // reader identifies the metric, it consumes pairs on its own
+    nvmlReturn_t read(nvmlDevice_t device, const void* reader, unsigned int metric_id, double& value)
+    {
+        value = std::numeric_limits<double>::quiet_NaN();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::uint64_t& seen = consumed[reader];
+        if (seen == taken) {
+            nvmlReturn_t ret = sample(device);
+            if (NVML_SUCCESS != ret) {
+                return ret;
+            }
+        }
+        seen = taken;
+        if (taken < 2) {
+            return NVML_SUCCESS;
+        }
+
+        request.version = NVML_GPM_METRICS_GET_VERSION;
+        request.numMetrics = 1;
+        request.sample1 = samples[(taken - 2) % 2];
+        request.sample2 = samples[(taken - 1) % 2];
+        request.metrics[0].metricId = metric_id;
+        nvmlReturn_t ret = nvml_lib().nvmlGpmMetricsGet(&request);
+        if (NVML_SUCCESS != ret) {
+            return ret;
+        }
+        if (NVML_SUCCESS != request.metrics[0].nvmlReturn) {
+            return request.metrics[0].nvmlReturn;
+        }
+        value = request.metrics[0].value;
+        return NVML_SUCCESS;
+    }
+
+private:
+    // overwrites the older sample of the pair
+    nvmlReturn_t sample(nvmlDevice_t device)
+    {
+        if (taken == 0) {
+            nvmlGpmSupport_t support = {};
+            support.version = NVML_GPM_SUPPORT_VERSION;
+            nvmlReturn_t ret = nvml_lib().nvmlGpmQueryDeviceSupport(device, &support);
+            if (NVML_SUCCESS != ret) {
+                return ret;
+            }
+            if (!support.isSupportedDevice) {
+                return NVML_ERROR_NOT_SUPPORTED;
+            }
+            for (auto& sample : samples) {
+                ret = nvml_lib().nvmlGpmSampleAlloc(&sample);
+                if (NVML_SUCCESS != ret) {
+                    return ret;
+                }
+            }
+        }
+
+        nvmlReturn_t ret = nvml_lib().nvmlGpmSampleGet(device, samples[taken % 2]);
+        if (NVML_SUCCESS == ret) {
+            ++taken;
+        }
+        return ret;
+    }
+
+    std::mutex mutex;
+    nvmlGpmSample_t samples[2] = { nullptr, nullptr };
+    // number of samples taken, the newest is samples[(taken - 1) % 2]
+    std::uint64_t taken = 0;
+    std::map<const void*, std::uint64_t> consumed;
+    // large, so it is not put on the stack for every read
+    nvmlGpmMetricsGet_t request;
+};
+
+/** The GPM samplers of all devices of a plugin. They have to be released before NVML is
+ *  shut down, see release_gpm_samplers.
+ */
+class gpm_sampler_registry {
+public:
+    gpm_sampler& get(nvmlDevice_t device)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<gpm_sampler>& sampler = samplers[device];
+        if (!sampler) {
+            sampler.reset(new gpm_sampler());
+        }
+        return *sampler;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        samplers.clear();
+    }
+
+private:
+    std::mutex mutex;
+    std::map<nvmlDevice_t, std::unique_ptr<gpm_sampler>> samplers;
+};
+
+inline gpm_sampler_registry& gpm_samplers()
+{
+    static gpm_sampler_registry registry;
+    return registry;
+}
+
+inline void release_gpm_samplers()
+{
+    gpm_samplers().clear();
+}
+
+// one GPM metric, percent of peak or MiB/s
+class Gpm_Metric : public Nvml_Metric {
+public:
+    Gpm_Metric(std::string name_, unsigned int metric_id_, std::string desc_, std::string unit_)
+        : metric_id(metric_id_)
+    {
+        name = name_;
+        desc = desc_;
+        unit = unit_;
+        type = metric_measure_type::ABS;
+        datatype = metric_datatype::DOUBLE;
+        api = "nvmlGpmSampleGet";
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value)
+    {
+        double result;
+        nvmlReturn_t ret = gpm_samplers().get(device).read(device, this, metric_id, result);
+        value = double_to_bits(result);
+
+        return ret;
+    }
+
+private:
+    unsigned int metric_id;
+};
+
+// GPM metrics, nullptr for other names
+inline Nvml_Metric* metric_name_2_gpm_function(const std::string& metric_name)
+{
+    struct gpm_metric_info {
+        const char* name;
+        unsigned int id;
+        const char* desc;
+        const char* unit;
+    };
+    static const gpm_metric_info metrics[] = {
+        { "gpm_graphics_util", NVML_GPM_METRIC_GRAPHICS_UTIL, "Graphics engine activity", "%" },
+        { "gpm_sm_util", NVML_GPM_METRIC_SM_UTIL, "SM activity", "%" },
+        { "gpm_sm_occupancy", NVML_GPM_METRIC_SM_OCCUPANCY, "SM occupancy", "%" },
+        { "gpm_integer_util", NVML_GPM_METRIC_INTEGER_UTIL, "Integer pipe utilization", "%" },
+        { "gpm_tensor_util", NVML_GPM_METRIC_ANY_TENSOR_UTIL, "Tensor pipe utilization", "%" },
+        { "gpm_dfma_tensor_util", NVML_GPM_METRIC_DFMA_TENSOR_UTIL,
+          "FP64 tensor pipe utilization", "%" },
+        { "gpm_hmma_tensor_util", NVML_GPM_METRIC_HMMA_TENSOR_UTIL,
+          "FP16 tensor pipe utilization", "%" },
+        { "gpm_imma_tensor_util", NVML_GPM_METRIC_IMMA_TENSOR_UTIL,
+          "Integer tensor pipe utilization", "%" },
+        { "gpm_fp64_util", NVML_GPM_METRIC_FP64_UTIL, "FP64 pipe utilization", "%" },
+        { "gpm_fp32_util", NVML_GPM_METRIC_FP32_UTIL, "FP32 pipe utilization", "%" },
+        { "gpm_fp16_util", NVML_GPM_METRIC_FP16_UTIL, "FP16 pipe utilization", "%" },
+        { "gpm_dram_bw_util", NVML_GPM_METRIC_DRAM_BW_UTIL, "DRAM bandwidth utilization", "%" },
+        { "gpm_pcie_tx", NVML_GPM_METRIC_PCIE_TX_PER_SEC, "PCIe send throughput", "MiB/s" },
+        { "gpm_pcie_rx", NVML_GPM_METRIC_PCIE_RX_PER_SEC, "PCIe receive throughput", "MiB/s" },
+        { "gpm_nvlink_tx", NVML_GPM_METRIC_NVLINK_TOTAL_TX_PER_SEC, "NVLink send throughput",
+          "MiB/s" },
+        { "gpm_nvlink_rx", NVML_GPM_METRIC_NVLINK_TOTAL_RX_PER_SEC, "NVLink receive throughput",
+          "MiB/s" },
+    };
+    for (auto& metric : metrics) {
+        if (metric_name == metric.name) {
+            return new Gpm_Metric(metric_name, metric.id, metric.desc, metric.unit);
+        }
+    }
+    return nullptr;
+}
+#else
+inline void release_gpm_samplers()
+{
+}
+
+inline Nvml_Metric* metric_name_2_gpm_function(const std::string& metric_name)
+{
+    throw std::runtime_error("Metric " + metric_name +
+                             " needs GPM, which the plugin was built without (nvml.h of CUDA 12 "
+                             "or newer)");
+}
+#endif
+
 class Nvml_Sampling_Metric {
 public:
     virtual ~Nvml_Sampling_Metric()
@@ -392,51 +1019,66 @@ public:
         free(samples);
     }
 
-    virtual std::vector<pair_time_sampling_t> get_value(nvmlDevice_t device,
-                                                        unsigned long long last_seen = 0)
+    // appends all samples newer than last_seen to values, does not throw so it
+    // can be used on the hot path
+    virtual nvmlReturn_t read(nvmlDevice_t device,
+                              unsigned long long last_seen,
+                              std::vector<pair_time_sampling_t>& values)
     {
         nvmlValueType_t val_type;
         unsigned int sample_count;
 
-        std::vector<pair_time_sampling_t> vec;
-        nvmlReturn_t ret;
-
-        if (device == NULL) {
-            throw std::runtime_error(
-                "CUDA device for metric sampling not set.");
-        }
-
         // get number of samples to allocate memory
-        ret = nvmlDeviceGetSamples(device, sample_type, last_seen, &val_type,
-                                   &sample_count, NULL);
-        check_nvml_return(ret, name);
-        vec.reserve(sample_count);
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetSamples(device, sample_type, last_seen,
+                                                &val_type, &sample_count, NULL);
+        if (NVML_ERROR_NOT_FOUND == ret) {
+            // no samples newer than last_seen
+            return NVML_SUCCESS;
+        }
+        if (NVML_SUCCESS != ret) {
+            return ret;
+        }
 
         if (sample_count > last_sample_count) {
-            samples = (nvmlSample_t*)malloc(sample_count * sizeof(nvmlSample_t));
-            if (samples == NULL) {
-                throw std::runtime_error(
-                    "Failed to allocate NVML sampling buffer");
+            nvmlSample_t* buffer =
+                (nvmlSample_t*)realloc(samples, sample_count * sizeof(nvmlSample_t));
+            if (buffer == NULL) {
+                return NVML_ERROR_MEMORY;
             }
+            samples = buffer;
             last_sample_count = sample_count;
         }
 
         // get samples
-        ret = nvmlDeviceGetSamples(device, sample_type, last_seen, &val_type,
+        ret = nvml_lib().nvmlDeviceGetSamples(device, sample_type, last_seen, &val_type,
                                    &sample_count, samples);
-
+        if (NVML_ERROR_NOT_FOUND == ret) {
+            return NVML_SUCCESS;
+        }
         if (NVML_SUCCESS != ret) {
-            free(samples);
-            throw std::runtime_error("Could not fetch data from NVML. " +
-                                     std::string(nvmlErrorString(ret)) +
-                                     "   Error Code: " + std::to_string(ret));
+            return ret;
         }
 
+        values.reserve(values.size() + sample_count);
         for (unsigned int i = 0; i < sample_count; ++i) {
-            vec.emplace_back(samples[i].timeStamp, samples[i].sampleValue.uiVal);
+            values.emplace_back(samples[i].timeStamp, samples[i].sampleValue.uiVal);
         }
 
-        return vec;
+        return NVML_SUCCESS;
+    }
+
+    // checks once whether the device keeps samples of this type
+    nvmlReturn_t probe(nvmlDevice_t& device)
+    {
+        nvmlValueType_t val_type;
+        unsigned int sample_count;
+
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetSamples(device, sample_type, 0, &val_type,
+                                                &sample_count, NULL);
+        if (NVML_ERROR_NOT_FOUND == ret) {
+            return NVML_SUCCESS;
+        }
+        return ret;
     }
 
     const std::string& get_name() const
@@ -444,6 +1086,12 @@ public:
         return name;
     }
 
+    // NVML entry point used by read(), for overhead statistics
+    const char* get_api() const
+    {
+        return api;
+    }
+
     const std::string& get_desc() const
     {
         return desc;
@@ -470,6 +1118,7 @@ protected:
     std::string unit;
     metric_measure_type type;
     metric_datatype datatype;
+    const char* api = "nvmlDeviceGetSamples";
 
     nvmlSamplingType_t sample_type = nvmlSamplingType_t::NVML_GPU_UTILIZATION_SAMPLES;
 
@@ -547,6 +1196,338 @@ public:
     }
 };
 
+class Nvml_Event_Metric {
+public:
+    virtual ~Nvml_Event_Metric() = default;
+
+    // reads the value recorded when one of the events in get_event_type() is
+    // reported for device, does not throw so it can be used on the hot path
+    virtual nvmlReturn_t read(nvmlDevice_t& device,
+                              const nvmlEventData_t& event,
+                              std::uint64_t& value) = 0;
+
+    // whether the metric has a state that is also recorded once at start
+    virtual bool has_state() const
+    {
+        return true;
+    }
+
+    // checks once whether the device reports the events and the state can be read
+    nvmlReturn_t probe(nvmlDevice_t& device)
+    {
+        unsigned long long supported;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetSupportedEventTypes(device, &supported);
+        if (NVML_SUCCESS != ret) {
+            return ret;
+        }
+        if ((supported & event_type) != event_type) {
+            return NVML_ERROR_NOT_SUPPORTED;
+        }
+        if (!has_state()) {
+            return NVML_SUCCESS;
+        }
+
+        nvmlEventData_t event = {};
+        event.device = device;
+        std::uint64_t value;
+        return read(device, event, value);
+    }
+
+    unsigned long long get_event_type() const
+    {
+        return event_type;
+    }
+
+    const std::string& get_name() const
+    {
+        return name;
+    }
+
+    // NVML entry point used by read(), for overhead statistics
+    const char* get_api() const
+    {
+        return api;
+    }
+
+    const std::string& get_desc() const
+    {
+        return desc;
+    }
+
+    const std::string& get_unit() const
+    {
+        return unit;
+    }
+
+    const metric_measure_type get_measure_type() const
+    {
+        return type;
+    }
+
+    const metric_datatype get_datatype() const
+    {
+        return datatype;
+    }
+
+protected:
+    std::string name;
+    std::string desc;
+    std::string unit;
+    metric_measure_type type;
+    metric_datatype datatype;
+    const char* api = "";
+
+    unsigned long long event_type = nvmlEventTypeNone;
+};
+
+class Clock_Sm_Event : public Nvml_Event_Metric {
+public:
+    Clock_Sm_Event(std::string name_ = "")
+    {
+        name = name_;
+        desc = "SM clocks (on clock change events)";
+        unit = "MHz";
+        type = metric_measure_type::ABS;
+        datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetClockInfo";
+
+        event_type = nvmlEventTypeClock;
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, const nvmlEventData_t& event, std::uint64_t& value)
+    {
+        unsigned int clock = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetClockInfo(device, NVML_CLOCK_SM, &clock);
+        value = clock;
+
+        return ret;
+    }
+};
+
+class Clock_Mem_Event : public Nvml_Event_Metric {
+public:
+    Clock_Mem_Event(std::string name_ = "")
+    {
+        name = name_;
+        desc = "Memory clocks (on clock change events)";
+        unit = "MHz";
+        type = metric_measure_type::ABS;
+        datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetClockInfo";
+
+        event_type = nvmlEventTypeClock;
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, const nvmlEventData_t& event, std::uint64_t& value)
+    {
+        unsigned int clock = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetClockInfo(device, NVML_CLOCK_MEM, &clock);
+        value = clock;
+
+        return ret;
+    }
+};
+
+class Throttle_Reasons_Event : public Nvml_Event_Metric {
+public:
+    Throttle_Reasons_Event(std::string name_ = "")
+    {
+        name = name_;
+        desc = "Clock throttle reasons bitmask (on clock change events)";
+        unit = "";
+        type = metric_measure_type::ABS;
+        datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetCurrentClocksThrottleReasons";
+
+        event_type = nvmlEventTypeClock;
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, const nvmlEventData_t& event, std::uint64_t& value)
+    {
+        unsigned long long reasons = 0;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetCurrentClocksThrottleReasons(device, &reasons);
+        value = reasons;
+
+        return ret;
+    }
+};
+
+class Pstate_Event : public Nvml_Event_Metric {
+public:
+    Pstate_Event(std::string name_ = "")
+    {
+        name = name_;
+        desc = "Performance state (on P-state change events)";
+        unit = "";
+        type = metric_measure_type::ABS;
+        datatype = metric_datatype::UINT;
+        api = "nvmlDeviceGetPerformanceState";
+
+        event_type = nvmlEventTypePState;
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, const nvmlEventData_t& event, std::uint64_t& value)
+    {
+        nvmlPstates_t pstate = NVML_PSTATE_UNKNOWN;
+        nvmlReturn_t ret = nvml_lib().nvmlDeviceGetPerformanceState(device, &pstate);
+        value = pstate;
+
+        return ret;
+    }
+};
+
+class Xid_Event : public Nvml_Event_Metric {
+public:
+    Xid_Event(std::string name_ = "")
+    {
+        name = name_;
+        desc = "XID of critical errors";
+        unit = "";
+        type = metric_measure_type::ABS;
+        datatype = metric_datatype::UINT;
+
+        event_type = nvmlEventTypeXidCriticalError;
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, const nvmlEventData_t& event, std::uint64_t& value)
+    {
+        value = event.eventData;
+
+        return NVML_SUCCESS;
+    }
+
+    // XIDs only exist as events
+    bool has_state() const
+    {
+        return false;
+    }
+};
+
+// all metric names known to metric_name_2_nvml_function
+inline const std::vector<std::string>& nvml_metric_names()
+{
+    static const std::vector<std::string> names = {
+        "power_usage", "temperature", "clock_sm", "clock_mem", "fan_speed",
+        "mem_free", "mem_used", "pcie_send", "pcie_recv", "utilization_gpu",
+        "utilization_mem", "freq_sm", "freq_mem", "freq_graphics", "energy", "throttle_reasons",
+        "violation_power", "violation_thermal", "violation_reliability", "nvlink_tx", "nvlink_rx",
+        "nvlink_replay_errors", "nvlink_recovery_errors", "nvlink_crc_flit_errors",
+        "nvlink_crc_data_errors",
+#ifdef NVML_GPM_METRICS_GET_VERSION
+        "gpm_graphics_util", "gpm_sm_util", "gpm_sm_occupancy", "gpm_integer_util",
+        "gpm_tensor_util", "gpm_dfma_tensor_util", "gpm_hmma_tensor_util", "gpm_imma_tensor_util",
+        "gpm_fp64_util", "gpm_fp32_util", "gpm_fp16_util", "gpm_dram_bw_util", "gpm_pcie_tx",
+        "gpm_pcie_rx", "gpm_nvlink_tx", "gpm_nvlink_rx",
+#endif
+    };
+    return names;
+}
+
+// all metric names known to metric_name_2_nvml_sampling_function
+inline const std::vector<std::string>& nvml_sampling_metric_names()
+{
+    static const std::vector<std::string> names = {
+        "power_usage", "clock_sm", "clock_mem", "utilization_gpu", "utilization_mem"};
+    return names;
+}
+
+/** Base of metrics that stand in for another one, with its name, unit and counter properties.
+ */
+class Wrapped_Metric : public Nvml_Metric {
+protected:
+    explicit Wrapped_Metric(Nvml_Metric* inner_)
+        : inner(inner_)
+    {
+        name = inner->get_name();
+        desc = inner->get_desc();
+        unit = inner->get_unit();
+        type = inner->get_measure_type();
+        datatype = inner->get_datatype();
+        api = inner->get_api();
+        counter_bits = inner->get_counter_bits();
+        counter_scale = inner->get_counter_scale();
+        blocking = inner->is_blocking();
+    }
+
+public:
+    void bind_device(nvmlDevice_t device, unsigned int device_idx) override
+    {
+        inner->bind_device(device, device_idx);
+    }
+
+protected:
+    std::unique_ptr<Nvml_Metric> inner;
+};
+
+// writes every read of the wrapped metric to the SCOREP_METRIC_NVML_RECORD file
+class Recorded_Metric : public Wrapped_Metric {
+public:
+    Recorded_Metric(Nvml_Metric* inner_, reading_recorder& recorder_)
+        : Wrapped_Metric(inner_), recorder(recorder_)
+    {
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value) override
+    {
+        value = 0;
+        auto start = std::chrono::steady_clock::now();
+        nvmlReturn_t ret = inner->read(device, value);
+        auto duration = std::chrono::steady_clock::now() - start;
+
+        recorder.reading(name, device_index(device), start,
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(),
+                         ret, value);
+        return ret;
+    }
+
+    // handles are created before the measurement starts, the reads then need no lock
+    void bind_device(nvmlDevice_t device, unsigned int device_idx) override
+    {
+        Wrapped_Metric::bind_device(device, device_idx);
+        for (auto& index : indices) {
+            if (index.first == device) {
+                return;
+            }
+        }
+        indices.emplace_back(device, device_idx);
+    }
+
+private:
+    // NVML index of device, asked for if it has no handle yet (e.g. when probed)
+    unsigned int device_index(nvmlDevice_t device) const
+    {
+        for (auto& index : indices) {
+            if (index.first == device) {
+                return index.second;
+            }
+        }
+        unsigned int device_idx = 0;
+        nvml_lib().nvmlDeviceGetIndex(device, &device_idx);
+        return device_idx;
+    }
+
+    reading_recorder& recorder;
+    // NVML index of each device with a handle, few enough for a linear search
+    std::vector<std::pair<nvmlDevice_t, unsigned int>> indices;
+};
+
+// returns the readings of the SCOREP_METRIC_NVML_REPLAY file instead of calling NVML
+class Replayed_Metric : public Wrapped_Metric {
+public:
+    Replayed_Metric(Nvml_Metric* inner_, reading_replayer& replayer_)
+        : Wrapped_Metric(inner_), replayer(replayer_)
+    {
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value) override
+    {
+        return replayer.next(name, replay_device_index(device), value);
+    }
+
+private:
+    reading_replayer& replayer;
+};
+
 Nvml_Metric* metric_name_2_nvml_function(std::string metric_name)
 {
     Nvml_Metric* metric;
@@ -592,8 +1573,42 @@ Nvml_Metric* metric_name_2_nvml_function(std::string metric_name)
     else if (metric_name.compare("freq_graphics") == 0) {
         metric = new Freq_Graphics(metric_name);
     }
+    else if (metric_name.compare("energy") == 0) {
+        metric = new Energy(metric_name);
+    }
+    else if (metric_name.compare("throttle_reasons") == 0) {
+        metric = new Throttle_Reasons(metric_name);
+    }
+    else if (metric_name.compare("violation_power") == 0) {
+        metric = new Violation_Time(metric_name, NVML_PERF_POLICY_POWER);
+    }
+    else if (metric_name.compare("violation_thermal") == 0) {
+        metric = new Violation_Time(metric_name, NVML_PERF_POLICY_THERMAL);
+    }
+    else if (metric_name.compare("violation_reliability") == 0) {
+        metric = new Violation_Time(metric_name, NVML_PERF_POLICY_RELIABILITY);
+    }
+    else if (metric_name.compare(0, 7, "nvlink_") == 0) {
+        metric = metric_name_2_nvlink_function(metric_name);
+        if (metric == nullptr) {
+            throw std::runtime_error("Unknown metric: " + metric_name);
+        }
+    }
+    else if (metric_name.compare(0, 4, "gpm_") == 0) {
+        metric = metric_name_2_gpm_function(metric_name);
+        if (metric == nullptr) {
+            throw std::runtime_error("Unknown metric: " + metric_name);
+        }
+    }
     else {
-        std::runtime_error("Unknown metric: " + metric_name);
+        throw std::runtime_error("Unknown metric: " + metric_name);
+    }
+
+    if (nvml_replayer() != nullptr) {
+        return new Replayed_Metric(metric, *nvml_replayer());
+    }
+    if (nvml_recorder() != nullptr) {
+        return new Recorded_Metric(metric, *nvml_recorder());
     }
     return metric;
 }
@@ -617,9 +1632,116 @@ Nvml_Sampling_Metric* metric_name_2_nvml_sampling_function(std::string metric_na
         metric = new Utilization_Mem_Sampling(metric_name);
     }
     else {
-        std::runtime_error("Unknown metric: " + metric_name);
+        throw std::runtime_error("Unknown metric: " + metric_name);
     }
     return metric;
 }
 
+Nvml_Event_Metric* metric_name_2_nvml_event_function(std::string metric_name)
+{
+    Nvml_Event_Metric* metric;
+    if (metric_name.compare("clock_sm") == 0) {
+        metric = new Clock_Sm_Event(metric_name);
+    }
+    else if (metric_name.compare("clock_mem") == 0) {
+        metric = new Clock_Mem_Event(metric_name);
+    }
+    else if (metric_name.compare("throttle_reasons") == 0) {
+        metric = new Throttle_Reasons_Event(metric_name);
+    }
+    else if (metric_name.compare("pstate") == 0) {
+        metric = new Pstate_Event(metric_name);
+    }
+    else if (metric_name.compare("xid") == 0) {
+        metric = new Xid_Event(metric_name);
+    }
+    else {
+        throw std::runtime_error("Unknown metric: " + metric_name);
+    }
+    return metric;
+}
+
+/** One metric read from the sample buffer of the GPU on devices that keep samples of it,
+ *  by polling on all others. Which one is used is decided per device by probe().
+ */
+class Hybrid_Metric {
+public:
+    // sampled may be nullptr if there are no samples of the metric
+    Hybrid_Metric(Nvml_Metric* polled_, Nvml_Sampling_Metric* sampled_)
+        : polled(polled_), sampled(sampled_)
+    {
+    }
+
+    nvmlReturn_t probe(nvmlDevice_t& device)
+    {
+        if (sampled && NVML_SUCCESS == sampled->probe(device)) {
+            sampled_devices.push_back(device);
+            return NVML_SUCCESS;
+        }
+        return polled->probe(device);
+    }
+
+    bool is_sampled(nvmlDevice_t device) const
+    {
+        return std::find(sampled_devices.begin(), sampled_devices.end(), device) !=
+               sampled_devices.end();
+    }
+
+    Nvml_Metric* get_polled()
+    {
+        return polled.get();
+    }
+
+    Nvml_Sampling_Metric* get_sampled()
+    {
+        return sampled.get();
+    }
+
+    // name, unit and type are the same for both sources
+    const std::string& get_name() const
+    {
+        return polled->get_name();
+    }
+
+    const std::string& get_desc() const
+    {
+        return polled->get_desc();
+    }
+
+    const std::string& get_unit() const
+    {
+        return polled->get_unit();
+    }
+
+    const metric_measure_type get_measure_type() const
+    {
+        return polled->get_measure_type();
+    }
+
+    const metric_datatype get_datatype() const
+    {
+        return polled->get_datatype();
+    }
+
+    unsigned int get_counter_bits() const
+    {
+        return polled->get_counter_bits();
+    }
+
+    std::uint64_t get_counter_scale() const
+    {
+        return polled->get_counter_scale();
+    }
+
+    std::chrono::milliseconds get_interval() const
+    {
+        return polled->get_interval();
+    }
+
+private:
+    std::unique_ptr<Nvml_Metric> polled;
+    std::unique_ptr<Nvml_Sampling_Metric> sampled;
+    std::vector<nvmlDevice_t> sampled_devices;
+};
+
 #endif // SCOREP_PLUGIN_NVML_NVML_WRAPPER_HPP
\ No newline at end of file
@@ -0,0 +1,357 @@
+// Measures the cost and update rate of every NVML metric on the devices of this node and
+// prints the supported metrics and recommended intervals as an env file, e.g.
+//   nvml_calibrate > nvml.env && source nvml.env
+#include <nvml_histogram.hpp>
+#include <nvml_wrapper.hpp>
+
+#include <nvml.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using steady_clock_t = std::chrono::steady_clock;
+
+struct options {
+    // reads per metric and device to measure the latency
+    unsigned int iterations = 100;
+    // time to watch the polled metrics of a device for changes
+    std::chrono::milliseconds window = std::chrono::milliseconds(1000);
+    // share of the interval one sweep may take
+    double duty = 0.01;
+};
+
+struct polled_result {
+    std::string metric;
+    unsigned int device;
+    nvmlReturn_t support;
+    // read by the slow lane of the plugin, not part of a sweep
+    bool blocking = false;
+    latency_histogram latency;
+    // 0 if the value did not change during the window or was not watched
+    std::chrono::microseconds update_period{ 0 };
+    // only while calibrating
+    std::unique_ptr<Nvml_Metric> reader;
+};
+
+struct sampled_result {
+    std::string metric;
+    unsigned int device;
+    nvmlReturn_t support;
+    latency_histogram latency;
+    unsigned int buffer_depth = 0;
+    // time covered by the samples in the buffer on the GPU
+    std::chrono::microseconds buffer_span{ 0 };
+};
+
+static std::uint64_t elapsed_ns(steady_clock_t::time_point begin)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(steady_clock_t::now() - begin)
+        .count();
+}
+
+// handle and NVML index of each device, the index differs from the position if devices are skipped
+static std::vector<nvml_device_info> get_devices()
+{
+    unsigned int num_devices;
+    nvmlReturn_t ret = nvml_lib().nvmlDeviceGetCount(&num_devices);
+    check_nvml_return(ret, "nvmlDeviceGetCount");
+
+    std::vector<nvml_device_info> devices;
+    for (unsigned int i = 0; i < num_devices; ++i) {
+        nvml_device_info info;
+        info.index = i;
+        ret = nvml_lib().nvmlDeviceGetHandleByIndex(i, &info.device);
+        if (NVML_SUCCESS == ret) {
+            devices.push_back(info);
+        }
+        else {
+            std::cerr << "Skipping device " << i << ": " << nvml_lib().nvmlErrorString(ret) << std::endl;
+        }
+    }
+    return devices;
+}
+
+static polled_result calibrate_polled(const std::string& metric_name,
+                                      unsigned int device_idx,
+                                      nvmlDevice_t device,
+                                      const options& opts)
+{
+    polled_result result;
+    result.metric = metric_name;
+    result.device = device_idx;
+    result.reader.reset(metric_name_2_nvml_function(metric_name));
+    result.support = result.reader->probe(device);
+    if (NVML_SUCCESS != result.support) {
+        result.reader.reset();
+        return result;
+    }
+    result.blocking = result.reader->is_blocking();
+
+    std::uint64_t value;
+    for (unsigned int i = 0; i < opts.iterations; ++i) {
+        auto begin = steady_clock_t::now();
+        result.reader->read(device, value);
+        result.latency.record(elapsed_ns(begin));
+    }
+    return result;
+}
+
+// polls the supported metrics of one device together about every millisecond and counts how
+// often each value changes, blocking metrics are too slow for that
+static void watch_polled(std::vector<polled_result>& results,
+                         nvmlDevice_t device,
+                         const options& opts)
+{
+    std::vector<polled_result*> watched;
+    for (auto& result : results) {
+        if (result.reader && !result.blocking) {
+            watched.push_back(&result);
+        }
+    }
+
+    std::vector<std::uint64_t> last(watched.size());
+    std::vector<unsigned int> changes(watched.size(), 0);
+    for (std::size_t i = 0; i < watched.size(); ++i) {
+        watched[i]->reader->read(device, last[i]);
+    }
+    std::uint64_t value;
+    auto begin = steady_clock_t::now();
+    while (steady_clock_t::now() - begin < opts.window) {
+        for (std::size_t i = 0; i < watched.size(); ++i) {
+            if (NVML_SUCCESS == watched[i]->reader->read(device, value) && value != last[i]) {
+                ++changes[i];
+                last[i] = value;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (std::size_t i = 0; i < watched.size(); ++i) {
+        if (changes[i] > 0) {
+            watched[i]->update_period =
+                std::chrono::duration_cast<std::chrono::microseconds>(opts.window) / changes[i];
+        }
+    }
+
+    for (auto& result : results) {
+        result.reader.reset();
+    }
+}
+
+static sampled_result calibrate_sampled(const std::string& metric_name,
+                                        unsigned int device_idx,
+                                        nvmlDevice_t device,
+                                        const options& opts)
+{
+    std::unique_ptr<Nvml_Sampling_Metric> metric(metric_name_2_nvml_sampling_function(metric_name));
+
+    sampled_result result;
+    result.metric = metric_name;
+    result.device = device_idx;
+    result.support = metric->probe(device);
+    if (NVML_SUCCESS != result.support) {
+        return result;
+    }
+
+    // everything in the buffer, i.e. its depth and the time it covers
+    std::vector<pair_time_sampling_t> samples;
+    if (NVML_SUCCESS == metric->read(device, 0, samples) && !samples.empty()) {
+        result.buffer_depth = samples.size();
+        auto minmax = std::minmax_element(
+            samples.begin(), samples.end(),
+            [](const pair_time_sampling_t& a, const pair_time_sampling_t& b) {
+                return a.first < b.first;
+            });
+        result.buffer_span =
+            std::chrono::microseconds(minmax.second->first - minmax.first->first);
+    }
+
+    for (unsigned int i = 0; i < opts.iterations; ++i) {
+        samples.clear();
+        auto begin = steady_clock_t::now();
+        metric->read(device, 0, samples);
+        result.latency.record(elapsed_ns(begin));
+    }
+    return result;
+}
+
+static std::string join(const std::vector<std::string>& names)
+{
+    std::string joined;
+    for (auto& name : names) {
+        joined += (joined.empty() ? "" : ",") + name;
+    }
+    return joined;
+}
+
+static void add_unique(std::vector<std::string>& names, const std::string& name)
+{
+    if (std::find(names.begin(), names.end(), name) == names.end()) {
+        names.push_back(name);
+    }
+}
+
+static void print_usage(const char* argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [-n iterations] [-w window_ms] [-d duty_percent]\n"
+              << "  -n  reads per metric and device to measure latency (default 100)\n"
+              << "  -w  time in ms to watch the polled metrics of each device for changes (default "
+                 "1000)\n"
+              << "  -d  share of the interval one sweep may take in percent (default 1)\n";
+}
+
+int main(int argc, char** argv)
+{
+    options opts;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:d:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            opts.iterations = std::stoul(optarg);
+            break;
+        case 'w':
+            opts.window = std::chrono::milliseconds(std::stoul(optarg));
+            break;
+        case 'd':
+            opts.duty = std::stod(optarg) / 100.0;
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (opts.iterations == 0 || opts.window.count() == 0 || opts.duty <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    nvmlReturn_t ret = nvml_lib().nvmlInit_v2();
+    if (NVML_SUCCESS != ret) {
+        std::cerr << "Could not start NVML: " << nvml_lib().nvmlErrorString(ret) << std::endl;
+        return 1;
+    }
+
+    std::vector<nvml_device_info> devices = get_devices();
+
+    std::vector<polled_result> polled;
+    std::vector<sampled_result> sampled;
+    for (auto& info : devices) {
+        std::vector<polled_result> device_polled;
+        for (auto& metric_name : nvml_metric_names()) {
+            std::cerr << "Calibrating " << metric_name << " on CUDA " << info.index << std::endl;
+            device_polled.push_back(calibrate_polled(metric_name, info.index, info.device, opts));
+        }
+        std::cerr << "Watching the metrics of CUDA " << info.index << " for changes" << std::endl;
+        watch_polled(device_polled, info.device, opts);
+        for (auto& result : device_polled) {
+            polled.push_back(std::move(result));
+        }
+        for (auto& metric_name : nvml_sampling_metric_names()) {
+            sampled.push_back(calibrate_sampled(metric_name, info.index, info.device, opts));
+        }
+    }
+
+    // GPM samples are freed with NVML still running
+    release_gpm_samplers();
+    nvml_lib().nvmlShutdown();
+
+    std::cout << "# nvml_calibrate: " << devices.size() << " device(s), " << opts.iterations
+              << " reads per metric\n";
+
+    // polled: a sweep reads every supported metric on every device, the interval is chosen so a
+    // sweep takes at most duty of it, but not shorter than the fastest metric updates. Blocking
+    // metrics are read by the slow lane instead, their reads mostly wait in the driver, so it may
+    // be busy half of their interval.
+    std::cout << "#\n# polled metrics (nvml_plugin, nvml_sync_plugin)\n"
+              << "# metric               device  mean_us  p99_us  update_ms\n";
+    std::vector<std::string> polled_names;
+    std::vector<std::string> blocking_names;
+    std::uint64_t sweep_ns = 0;
+    std::uint64_t slow_lane_ns = 0;
+    std::chrono::microseconds fastest_update{ 0 };
+    for (auto& result : polled) {
+        std::cout << "# " << std::left << std::setw(21) << result.metric << std::setw(8)
+                  << result.device << std::right;
+        if (NVML_SUCCESS != result.support) {
+            std::cout << "not supported (" << nvml_lib().nvmlErrorString(result.support) << ")\n";
+            continue;
+        }
+        std::cout << std::setw(7) << result.latency.sum() / result.latency.count() / 1000
+                  << std::setw(8) << result.latency.percentile(99) / 1000 << std::setw(11);
+        if (result.blocking) {
+            add_unique(blocking_names, result.metric);
+            slow_lane_ns += result.latency.sum() / result.latency.count();
+            std::cout << "blocking\n";
+            continue;
+        }
+        add_unique(polled_names, result.metric);
+        sweep_ns += result.latency.sum() / result.latency.count();
+
+        if (result.update_period.count() > 0) {
+            std::cout << result.update_period.count() / 1000;
+            if (fastest_update.count() == 0 || result.update_period < fastest_update) {
+                fastest_update = result.update_period;
+            }
+        }
+        else {
+            std::cout << "-";
+        }
+        std::cout << "\n";
+    }
+    std::uint64_t polled_interval_ms = static_cast<std::uint64_t>(sweep_ns / opts.duty / 1000000);
+    polled_interval_ms = std::max<std::uint64_t>(
+        { polled_interval_ms, static_cast<std::uint64_t>(fastest_update.count() / 1000), 1 });
+    std::uint64_t blocking_interval_ms =
+        std::max<std::uint64_t>(2 * slow_lane_ns / 1000000 + 1, polled_interval_ms);
+    for (auto& name : blocking_names) {
+        polled_names.push_back(name + ":" + std::to_string(blocking_interval_ms) + "ms");
+    }
+
+    // sampled: the buffer on the GPU has to be read before it wraps around, half of the shortest
+    // span leaves enough headroom
+    std::cout << "#\n# sampled metrics (nvml_sampling_plugin)\n"
+              << "# metric               device  mean_us  depth  span_ms\n";
+    std::vector<std::string> sampled_names;
+    std::chrono::microseconds shortest_span{ 0 };
+    for (auto& result : sampled) {
+        std::cout << "# " << std::left << std::setw(21) << result.metric << std::setw(8)
+                  << result.device << std::right;
+        if (NVML_SUCCESS != result.support) {
+            std::cout << "not supported (" << nvml_lib().nvmlErrorString(result.support) << ")\n";
+            continue;
+        }
+        add_unique(sampled_names, result.metric);
+
+        std::cout << std::setw(7) << result.latency.sum() / result.latency.count() / 1000
+                  << std::setw(7) << result.buffer_depth << std::setw(9)
+                  << result.buffer_span.count() / 1000 << "\n";
+        if (result.buffer_span.count() > 0 &&
+            (shortest_span.count() == 0 || result.buffer_span < shortest_span)) {
+            shortest_span = result.buffer_span;
+        }
+    }
+    std::uint64_t sampled_interval_ms =
+        shortest_span.count() > 0 ? std::max<std::uint64_t>(shortest_span.count() / 2000, 1) : 5000;
+
+    std::cout << "#\n";
+    if (!polled_names.empty()) {
+        std::cout << "export SCOREP_METRIC_NVML_PLUGIN=\"" << join(polled_names) << "\"\n"
+                  << "export SCOREP_METRIC_NVML_PLUGIN_INTERVAL=\"" << polled_interval_ms << "\"\n";
+    }
+    if (!sampled_names.empty()) {
+        std::cout << "export SCOREP_METRIC_NVML_SAMPLING_PLUGIN=\"" << join(sampled_names) << "\"\n"
+                  << "export SCOREP_METRIC_NVML_SAMPLING_PLUGIN_INTERVAL=\"" << sampled_interval_ms
+                  << "\"\n";
+    }
+    return 0;
+}
@@ -0,0 +1,4 @@
+//#include <nvml_plugin.hpp>
+#include <nvml_event_plugin.hpp>
+
+SCOREP_METRIC_PLUGIN_CLASS(nvml_event_plugin, "nvml_event")
\ No newline at end of file
@@ -0,0 +1,4 @@
+//#include <nvml_plugin.hpp>
+#include <nvml_hybrid_plugin.hpp>
+
+SCOREP_METRIC_PLUGIN_CLASS(nvml_hybrid_plugin, "nvml_hybrid")
\ No newline at end of file
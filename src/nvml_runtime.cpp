@@ -0,0 +1,7 @@
+#include <nvml_runtime.hpp>
+
+nvml_runtime& nvml_runtime::instance()
+{
+    static nvml_runtime runtime;
+    return runtime;
+}
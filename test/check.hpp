@@ -0,0 +1,47 @@
+#ifndef SCOREP_PLUGIN_NVML_TEST_CHECK_HPP
+#define SCOREP_PLUGIN_NVML_TEST_CHECK_HPP
+
+#include <cmath>
+#include <exception>
+#include <iostream>
+
+// minimal checks for the unit tests, a test fails if any check failed
+static int failed_checks = 0;
+
+#define CHECK(condition)                                                                           \
+    do {                                                                                           \
+        if (!(condition)) {                                                                        \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            ++failed_checks;                                                                       \
+        }                                                                                          \
+    } while (false)
+
+// |actual - expected| within relative of expected
+#define CHECK_NEAR(actual, expected, relative)                                                     \
+    CHECK(std::fabs(double(actual) - double(expected)) <= (relative)*std::fabs(double(expected)))
+
+#define CHECK_THROWS(statement)                                                                    \
+    do {                                                                                           \
+        bool thrown = false;                                                                       \
+        try {                                                                                      \
+            statement;                                                                             \
+        }                                                                                          \
+        catch (std::exception&) {                                                                  \
+            thrown = true;                                                                         \
+        }                                                                                          \
+        if (!thrown) {                                                                             \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": no exception: " #statement << std::endl; \
+            ++failed_checks;                                                                       \
+        }                                                                                          \
+    } while (false)
+
+inline int test_result()
+{
+    if (failed_checks != 0) {
+        std::cerr << failed_checks << " check(s) failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+#endif // SCOREP_PLUGIN_NVML_TEST_CHECK_HPP
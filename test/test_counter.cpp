@@ -0,0 +1,77 @@
+// counter_state: totals, rates, wraparound and resets
+#include "check.hpp"
+
+#include <nvml_counter.hpp>
+
+#include <chrono>
+#include <cstdint>
+
+using std::chrono::seconds;
+using time_point = std::chrono::system_clock::time_point;
+
+static void test_total()
+{
+    counter_state counter;
+    std::uint64_t value = 42;
+    CHECK(counter.update(1000, time_point(), 64, 1, false, value));
+    CHECK(value == 0);
+    CHECK(counter.update(1015, time_point(), 64, 1, false, value));
+    CHECK(value == 15);
+    CHECK(counter.update(1020, time_point(), 64, 1024, false, value));
+    CHECK(value == 15 + 5 * 1024);
+}
+
+static void test_wraparound()
+{
+    counter_state counter;
+    std::uint64_t value;
+    CHECK(counter.update(0xFFFFFFF0, time_point(), 32, 1, false, value));
+    CHECK(counter.update(0x10, time_point(), 32, 1, false, value));
+    CHECK(value == 0x20);
+
+    // bits of the raw value beyond the width of the counter are ignored
+    counter_state masked;
+    CHECK(masked.update(0x1FFFFFFFF, time_point(), 32, 1, false, value));
+    CHECK(masked.update(0x100000001, time_point(), 32, 1, false, value));
+    CHECK(value == 2);
+}
+
+static void test_reset()
+{
+    // a delta of more than half the range is a reset, the new raw value is the delta
+    counter_state counter;
+    std::uint64_t value;
+    CHECK(counter.update(1000, time_point(), 64, 1, false, value));
+    CHECK(counter.update(5, time_point(), 64, 1, false, value));
+    CHECK(value == 5);
+    CHECK(counter.update(7, time_point(), 64, 1, false, value));
+    CHECK(value == 7);
+}
+
+static void test_rate()
+{
+    counter_state counter;
+    std::uint64_t value;
+    time_point begin;
+    CHECK(!counter.update(100, begin, 64, 1, true, value));
+    CHECK(counter.update(300, begin + seconds(2), 64, 1, true, value));
+    CHECK(value == 100);
+    // no time passed, e.g. timestamp mode sweep
+    CHECK(!counter.update(400, begin + seconds(2), 64, 1, true, value));
+    CHECK(counter.update(400, begin + seconds(3), 64, 1024, true, value));
+    CHECK(value == 100 * 1024);
+    // wraparound of a 32 bit counter within one interval
+    counter_state wrapping;
+    CHECK(!wrapping.update(0xFFFFFF00, begin, 32, 1, true, value));
+    CHECK(wrapping.update(0x100, begin + seconds(1), 32, 1, true, value));
+    CHECK(value == 0x200);
+}
+
+int main()
+{
+    test_total();
+    test_wraparound();
+    test_reset();
+    test_rate();
+    return test_result();
+}
@@ -0,0 +1,184 @@
+// the expression parser and the evaluation of Derived_Metric, without reading any device
+#include "check.hpp"
+
+#include <nvml_derived.hpp>
+
+#include <cmath>
+#include <map>
+#include <vector>
+
+// two devices with NVML index 1 and 3, the handles are never passed to NVML
+static std::vector<nvml_device_info> devices()
+{
+    std::vector<nvml_device_info> result(2);
+    result[0].device = reinterpret_cast<nvmlDevice_t>(1);
+    result[0].index = 1;
+    result[1].device = reinterpret_cast<nvmlDevice_t>(2);
+    result[1].index = 3;
+    return result;
+}
+
+static void test_valid()
+{
+    CHECK(is_derived_metric_name("sum(power_usage@*)"));
+    CHECK(!is_derived_metric_name("power_usage"));
+
+    Derived_Metric node_sum("sum(power_usage@*)", devices());
+    CHECK(!node_sum.is_per_device());
+    CHECK(node_sum.get_unit() == "mW");
+    CHECK(node_sum.get_datatype() == DOUBLE);
+
+    Derived_Metric per_device("power_usage / 1000", devices());
+    CHECK(per_device.is_per_device());
+    CHECK(per_device.get_unit() == "mW");
+
+    // devices by NVML index
+    Derived_Metric explicit_devices("power_usage@1 - power_usage@3", devices());
+    CHECK(!explicit_devices.is_per_device());
+
+    Derived_Metric nested("2 * (avg(power_usage@*) + power_usage) / max(temperature@*)", devices());
+    CHECK(nested.is_per_device());
+}
+
+static void test_invalid()
+{
+    // positions 0 and 2 in the device list are no NVML indices
+    CHECK_THROWS(Derived_Metric("power_usage@0", devices()));
+    CHECK_THROWS(Derived_Metric("power_usage@2", devices()));
+    CHECK_THROWS(Derived_Metric("sum(power_usage)", devices()));
+    CHECK_THROWS(Derived_Metric("power_usage@*", devices()));
+    CHECK_THROWS(Derived_Metric("(power_usage", devices()));
+    CHECK_THROWS(Derived_Metric("power_usage)", devices()));
+    CHECK_THROWS(Derived_Metric("power_usage +", devices()));
+    CHECK_THROWS(Derived_Metric("no_such_metric + 1", devices()));
+}
+
+// inputs that read fake_values instead of NVML and count the reads
+static std::map<nvmlDevice_t, std::uint64_t> fake_values;
+static unsigned int fake_reads = 0;
+
+class Fake_Metric : public Nvml_Metric {
+public:
+    Fake_Metric(const std::string& name_)
+    {
+        name = name_;
+        unit = "mW";
+        datatype = metric_datatype::UINT;
+        type = metric_measure_type::ABS;
+    }
+
+    nvmlReturn_t read(nvmlDevice_t& device, std::uint64_t& value) override
+    {
+        ++fake_reads;
+        value = fake_values[device];
+        return NVML_SUCCESS;
+    }
+};
+
+static Nvml_Metric* create_fake(std::string metric_name)
+{
+    return new Fake_Metric(metric_name);
+}
+
+static double evaluate(Derived_Metric& metric, nvmlDevice_t device)
+{
+    std::uint64_t value = 0;
+    CHECK(metric.read(device, value) == NVML_SUCCESS);
+    return bits_to_double(value);
+}
+
+static void test_evaluate()
+{
+    std::vector<nvml_device_info> info = devices();
+    nvmlDevice_t first = info[0].device;
+    nvmlDevice_t second = info[1].device;
+    fake_values[first] = 100;
+    fake_values[second] = 300;
+
+    Derived_Metric sum("sum(power_usage@*)", info, create_fake);
+    CHECK(evaluate(sum, first) == 400);
+    Derived_Metric avg("avg(power_usage@*)", info, create_fake);
+    CHECK(evaluate(avg, first) == 200);
+    Derived_Metric min("min(power_usage@*)", info, create_fake);
+    CHECK(evaluate(min, first) == 100);
+    Derived_Metric max("max(power_usage@*)", info, create_fake);
+    CHECK(evaluate(max, first) == 300);
+
+    // by NVML index, not by position
+    Derived_Metric explicit_devices("power_usage@3 - power_usage@1", info, create_fake);
+    CHECK(evaluate(explicit_devices, first) == 200);
+
+    Derived_Metric per_device("(power_usage + 100) / 2", info, create_fake);
+    CHECK(evaluate(per_device, first) == 100);
+    CHECK(evaluate(per_device, second) == 200);
+
+    Derived_Metric division("power_usage / (power_usage@1 - 100)", info, create_fake);
+    CHECK(std::isnan(evaluate(division, first)));
+}
+
+static void test_sweeps()
+{
+    std::vector<nvml_device_info> info = devices();
+    nvmlDevice_t first = info[0].device;
+    nvmlDevice_t second = info[1].device;
+    fake_values[first] = 100;
+    fake_values[second] = 300;
+    fake_reads = 0;
+
+    // each input once per device and sweep, however often it is used
+    Derived_Metric deviation("power_usage - avg(power_usage@*) + 0 * power_usage@1", info, create_fake);
+    CHECK(evaluate(deviation, first) == -100);
+    CHECK(fake_reads == 2);
+    fake_values[first] = 500;
+    CHECK(evaluate(deviation, second) == 100);
+    CHECK(fake_reads == 2);
+
+    // evaluating a device again starts the next sweep
+    CHECK(evaluate(deviation, first) == 100);
+    CHECK(fake_reads == 4);
+}
+
+static void test_feed()
+{
+    std::vector<nvml_device_info> info = devices();
+    nvmlDevice_t first = info[0].device;
+    nvmlDevice_t second = info[1].device;
+    fake_reads = 0;
+
+    Derived_Metric sum("sum(power_usage@*)", info, create_fake);
+    CHECK(sum.feed_input("temperature", first) == -1);
+    int input = sum.feed_input("power_usage", first);
+    CHECK(input == 0);
+    CHECK(sum.feed_input("power_usage", second) == input);
+
+    // nothing fed yet
+    CHECK(std::isnan(evaluate(sum, first)));
+
+    auto now = std::chrono::system_clock::now();
+    sum.feed(input, first, NVML_SUCCESS, 10, now);
+    sum.feed(input, second, NVML_SUCCESS, 20, now);
+    CHECK(evaluate(sum, first) == 30);
+    // the latest value is used, also within a sweep
+    sum.feed(input, second, NVML_SUCCESS, 40, now);
+    CHECK(evaluate(sum, first) == 50);
+
+    // failed reads are left out, it only fails if all do
+    sum.feed(input, second, NVML_ERROR_UNKNOWN, 0, now);
+    CHECK(evaluate(sum, first) == 10);
+    sum.feed(input, first, NVML_ERROR_UNKNOWN, 0, now);
+    std::uint64_t value;
+    CHECK(sum.read(first, value) == NVML_ERROR_UNKNOWN);
+
+    // fed inputs are never read
+    CHECK(fake_reads == 0);
+}
+
+int main()
+{
+    test_valid();
+    test_invalid();
+    test_evaluate();
+    test_sweeps();
+    test_feed();
+    return test_result();
+}
@@ -0,0 +1,106 @@
+// quantile_sketch and value_summary
+#include "check.hpp"
+
+#include <nvml_summary.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <sstream>
+
+static void test_quantiles()
+{
+    quantile_sketch sketch;
+    CHECK(std::isnan(sketch.quantile(0.5)));
+
+    for (int i = 1; i <= 10000; ++i) {
+        sketch.add(i);
+    }
+    CHECK(sketch.count() == 10000);
+    // 1% relative error of the rank q * (n - 1)
+    CHECK_NEAR(sketch.quantile(0.5), 5000.5, 0.011);
+    CHECK_NEAR(sketch.quantile(0.95), 9500.05, 0.011);
+    CHECK_NEAR(sketch.quantile(0.99), 9900.01, 0.011);
+    CHECK_NEAR(sketch.quantile(0), 1, 0.011);
+    CHECK_NEAR(sketch.quantile(1), 10000, 0.011);
+}
+
+static void test_signs()
+{
+    quantile_sketch sketch;
+    sketch.add(-5);
+    sketch.add(0);
+    sketch.add(5);
+    CHECK_NEAR(sketch.quantile(0), -5, 0.011);
+    CHECK(sketch.quantile(0.5) == 0);
+    CHECK_NEAR(sketch.quantile(1), 5, 0.011);
+}
+
+static void test_merge()
+{
+    quantile_sketch all, low, high;
+    for (int i = 1; i <= 1000; ++i) {
+        all.add(i);
+        (i <= 500 ? low : high).add(i);
+    }
+    low.merge(high);
+    CHECK(low.count() == all.count());
+    for (double q : { 0.0, 0.1, 0.5, 0.9, 0.99, 1.0 }) {
+        CHECK(low.quantile(q) == all.quantile(q));
+    }
+}
+
+static void test_collapse()
+{
+    // far more buckets than kept, the lowest collapse and the upper quantiles stay accurate
+    quantile_sketch sketch;
+    for (int e = -9; e <= 12; ++e) {
+        for (int i = 1; i <= 100; ++i) {
+            sketch.add(i * std::pow(10.0, e));
+        }
+    }
+    CHECK_NEAR(sketch.quantile(1), 1e14, 0.011);
+    CHECK_NEAR(sketch.quantile(0.99), 8e13, 0.25);
+}
+
+static void test_summary()
+{
+    value_summary summary(UINT);
+    summary.add_condition(parse_summary_conditions("power_usage>150")[0]);
+    system_time_point_t begin;
+    summary.add(begin, 100);
+    summary.add(begin + std::chrono::seconds(1), 200);
+    summary.add(begin + std::chrono::seconds(3), 300);
+    CHECK(summary.count() == 3);
+
+    std::ostringstream json;
+    summary.write_json(json);
+    CHECK(json.str().find("\"count\": 3") != std::string::npos);
+    CHECK(json.str().find("\"mean\": 200") != std::string::npos);
+    CHECK(json.str().find("\"stddev\": 100") != std::string::npos);
+    CHECK(json.str().find("\"first\": 100") != std::string::npos);
+    // above 150 from the second until the third point
+    CHECK(json.str().find("\"power_usage>150\": 2") != std::string::npos);
+
+    CHECK_THROWS(parse_summary_conditions("power_usage~"));
+
+    // keys are escaped like the names of derived metrics
+    trigger_condition quoted;
+    quoted.metric = "a\"b";
+    quoted.op = '>';
+    value_summary escaped(UINT);
+    escaped.add_condition(quoted);
+    escaped.add(begin, 1);
+    std::ostringstream escaped_json;
+    escaped.write_json(escaped_json);
+    CHECK(escaped_json.str().find("\"a\\\"b>0\": ") != std::string::npos);
+}
+
+int main()
+{
+    test_quantiles();
+    test_signs();
+    test_merge();
+    test_collapse();
+    test_summary();
+    return test_result();
+}
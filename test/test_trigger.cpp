@@ -0,0 +1,92 @@
+// parse_triggers, trigger_condition and capture_ring
+#include "check.hpp"
+
+#include <nvml_trigger.hpp>
+
+#include <chrono>
+#include <vector>
+
+static system_time_point_t at(int ms)
+{
+    return system_time_point_t(std::chrono::milliseconds(ms));
+}
+
+static void test_parse()
+{
+    auto conditions = parse_triggers("power_usage>250000,throttle_reasons~,utilization_gpu<10.5");
+    CHECK(conditions.size() == 3);
+    CHECK(conditions[0].metric == "power_usage");
+    CHECK(conditions[0].op == '>');
+    CHECK(conditions[0].threshold == 250000);
+    CHECK(conditions[1].metric == "throttle_reasons");
+    CHECK(conditions[1].op == '~');
+    CHECK(conditions[2].metric == "utilization_gpu");
+    CHECK(conditions[2].op == '<');
+    CHECK(conditions[2].threshold == 10.5);
+
+    // empty items are skipped
+    CHECK(parse_triggers("").empty());
+    CHECK(parse_triggers(",temperature>80,").size() == 1);
+
+    CHECK_THROWS(parse_triggers(">5"));
+    CHECK_THROWS(parse_triggers("power_usage"));
+    CHECK_THROWS(parse_triggers("power_usage~1"));
+    CHECK_THROWS(parse_triggers("power_usage>"));
+    CHECK_THROWS(parse_triggers("power_usage>12W"));
+}
+
+static void test_fires()
+{
+    auto conditions = parse_triggers("power_usage>100,power_usage<10,power_usage~");
+    CHECK(!conditions[0].fires(100));
+    CHECK(conditions[0].fires(101));
+    CHECK(conditions[1].fires(9));
+    CHECK(!conditions[1].fires(10));
+    // a change needs a previous value
+    CHECK(!conditions[2].fires(5));
+    CHECK(!conditions[2].fires(5));
+    CHECK(conditions[2].fires(6));
+}
+
+static void test_ring()
+{
+    capture_ring ring;
+    ring.resize(3);
+    for (int i = 1; i <= 5; ++i) {
+        ring.push(at(i), i);
+    }
+    std::vector<pair_chrono_value_t> values;
+    ring.commit(values);
+    CHECK(values.size() == 3);
+    CHECK(values[0].first == at(3) && values[0].second == 3);
+    CHECK(values[2].first == at(5) && values[2].second == 5);
+
+    // the ring is empty after a commit
+    ring.commit(values);
+    CHECK(values.size() == 3);
+
+    // coarse points already recorded from the ring are replaced, values stay ordered
+    ring.push(at(6), 6);
+    ring.push(at(7), 7);
+    values.push_back(std::make_pair(at(7), 7));
+    ring.commit(values);
+    CHECK(values.size() == 5);
+    for (std::size_t i = 1; i < values.size(); ++i) {
+        CHECK(values[i - 1].first < values[i].first);
+    }
+
+    // without capacity nothing is kept
+    capture_ring empty;
+    empty.push(at(1), 1);
+    values.clear();
+    empty.commit(values);
+    CHECK(values.empty());
+}
+
+int main()
+{
+    test_parse();
+    test_fires();
+    test_ring();
+    return test_result();
+}